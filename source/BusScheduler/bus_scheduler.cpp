@@ -0,0 +1,291 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group I2C BUS SCHEDULER
+ *
+ * Shared I2C bus scheduler class definition.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#include "BusScheduler/bus_scheduler.hpp"
+
+#include "esp_timer.h"
+
+namespace BusScheduler
+{
+
+#define BUS_NO_OWNER                        -1
+
+/*
+ * vTaskPrioritySet() writes the base priority, while uxTaskPriorityGet()
+ * may return a priority inherited from a mutex. Restoring that one would
+ * leave the owner at the inherited priority for good, so the base is read
+ * from the kernel. Returns false when the kernel cannot report it.
+ */
+static bool base_priority(TaskHandle_t task, UBaseType_t *priority)
+{
+#if tskKERNEL_VERSION_MAJOR >= 11
+    *priority = uxTaskBasePriorityGet(task);
+    return true;
+#elif configUSE_TRACE_FACILITY == 1
+    TaskStatus_t status;
+    vTaskGetInfo(task, &status, pdFALSE, eInvalid);
+    *priority = status.uxBasePriority;
+    return true;
+#else
+    (void) task;
+    (void) priority;
+    return false;
+#endif
+}
+
+/*
+ * m_lock is a FreeRTOS mutex rather than a spinlock so that priority
+ * changes of the owner can be made while holding it. Boosting the owner
+ * and restoring it on release are then serialized, and a boost can never
+ * land after the owner already restored its priority.
+ */
+
+BusScheduler::BusScheduler()
+{
+    m_lock = xSemaphoreCreateMutex();
+    m_client_count = 0;
+    m_owner = BUS_NO_OWNER;
+    m_owner_priority = BUS_PRIORITY_BULK;
+    m_owner_task = NULL;
+    m_owner_boosted = false;
+    m_owner_base_priority = 0;
+    m_seq = 0;
+}
+
+BusScheduler::~BusScheduler()
+{
+    for (int idx = 0; idx < m_client_count; idx++)
+        vSemaphoreDelete(m_clients[idx].wake);
+
+    if (m_lock != NULL) vSemaphoreDelete(m_lock);
+}
+
+bool BusScheduler::is_client_valid(int id)
+{
+    return id >= 0 && id < m_client_count;
+}
+
+esp_err_t BusScheduler::add_client(const char *name, int *id)
+{
+    if (m_lock == NULL) return ESP_ERR_NO_MEM;
+
+    SemaphoreHandle_t wake = xSemaphoreCreateBinary();
+    if (wake == NULL) return ESP_ERR_NO_MEM;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    if (m_client_count >= BUS_SCHEDULER_MAX_CLIENTS)
+    {
+        xSemaphoreGive(m_lock);
+        vSemaphoreDelete(wake);
+        return ESP_ERR_NO_MEM;
+    }
+
+    Client_t *client = &m_clients[m_client_count];
+    *client = {};
+    client->name = name;
+    client->wake = wake;
+    *id = m_client_count++;
+
+    xSemaphoreGive(m_lock);
+
+    return ESP_OK;
+}
+
+// Called with m_lock held.
+void BusScheduler::grant(int id, TaskHandle_t task, BusPriority_t priority)
+{
+    m_owner = id;
+    m_owner_priority = priority;
+    m_owner_task = task;
+    m_owner_boosted = false;
+}
+
+// Called with m_lock held. Raises the owner to a waiter's RTOS priority.
+void BusScheduler::boost(UBaseType_t task_priority)
+{
+    if (m_owner_task == NULL || task_priority <= uxTaskPriorityGet(m_owner_task)) return;
+
+    if (!m_owner_boosted)
+    {
+        if (!base_priority(m_owner_task, &m_owner_base_priority)) return;
+        m_owner_boosted = true;
+    }
+
+    vTaskPrioritySet(m_owner_task, task_priority);
+}
+
+// Called with m_lock held. Only undoes a boost made by boost().
+void BusScheduler::unboost()
+{
+    if (!m_owner_boosted) return;
+
+    vTaskPrioritySet(m_owner_task, m_owner_base_priority);
+    m_owner_boosted = false;
+}
+
+// Called with m_lock held.
+void BusScheduler::record_wait(Client_t *client, int64_t start)
+{
+    uint32_t wait = (uint32_t) (esp_timer_get_time() - start);
+
+    client->stats.transactions++;
+    client->stats.wait_total_us += wait;
+    if (wait > client->stats.wait_max_us) client->stats.wait_max_us = wait;
+}
+
+esp_err_t BusScheduler::acquire(int id, BusPriority_t priority)
+{
+    if (!is_client_valid(id)) return ESP_ERR_INVALID_ARG;
+
+    Client_t *client = &m_clients[id];
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    UBaseType_t task_priority = uxTaskPriorityGet(NULL);
+    int64_t start = esp_timer_get_time();
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    if (m_owner == id)
+    {
+        xSemaphoreGive(m_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (m_owner == BUS_NO_OWNER)
+    {
+        grant(id, task, priority);
+        record_wait(client, start);
+        xSemaphoreGive(m_lock);
+        return ESP_OK;
+    }
+
+    client->priority = priority;
+    client->seq = m_seq++;
+    client->task = task;
+    client->task_priority = task_priority;
+    client->waiting = true;
+
+    boost(task_priority);
+
+    xSemaphoreGive(m_lock);
+
+    // release() transfers ownership before giving the semaphore
+    xSemaphoreTake(client->wake, portMAX_DELAY);
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    record_wait(client, start);
+    xSemaphoreGive(m_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t BusScheduler::release(int id)
+{
+    if (!is_client_valid(id)) return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    if (m_owner != id)
+    {
+        xSemaphoreGive(m_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    unboost();
+
+    Client_t *next = NULL;
+
+    for (int idx = 0; idx < m_client_count; idx++)
+    {
+        Client_t *client = &m_clients[idx];
+
+        if (!client->waiting) continue;
+
+        if (next == NULL || client->priority > next->priority ||
+            (client->priority == next->priority && (int32_t) (client->seq - next->seq) < 0))
+            next = client;
+    }
+
+    if (next != NULL)
+    {
+        next->waiting = false;
+        grant(next - m_clients, next->task, next->priority);
+
+        // the new owner inherits from whoever is still waiting
+        for (int idx = 0; idx < m_client_count; idx++)
+            if (m_clients[idx].waiting) boost(m_clients[idx].task_priority);
+    }
+    else
+        grant(BUS_NO_OWNER, NULL, BUS_PRIORITY_BULK);
+
+    xSemaphoreGive(m_lock);
+
+    if (next != NULL) xSemaphoreGive(next->wake);
+
+    return ESP_OK;
+}
+
+bool BusScheduler::should_yield(int id)
+{
+    bool yield = false;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    for (int idx = 0; idx < m_client_count && m_owner == id; idx++)
+    {
+        if (m_clients[idx].waiting && m_clients[idx].priority > m_owner_priority)
+        {
+            yield = true;
+            break;
+        }
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return yield;
+}
+
+esp_err_t BusScheduler::yield(int id)
+{
+    if (!should_yield(id)) return ESP_OK;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    BusPriority_t priority = m_owner_priority;
+    m_clients[id].stats.preemptions++;
+    xSemaphoreGive(m_lock);
+
+    esp_err_t err = release(id);
+    if (err != ESP_OK) return err;
+
+    return acquire(id, priority);
+}
+
+esp_err_t BusScheduler::read_stats(int id, BusClientStats_t *stats)
+{
+    if (!is_client_valid(id)) return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    *stats = m_clients[id].stats;
+    xSemaphoreGive(m_lock);
+
+    return ESP_OK;
+}
+
+} // namespace BusScheduler
@@ -0,0 +1,167 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group I2C BUS SCHEDULER
+ *
+ * Shared I2C bus scheduler class declaration.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#pragma once
+
+#include "esp_err.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+namespace BusScheduler
+{
+
+#define BUS_SCHEDULER_MAX_CLIENTS 8
+
+typedef enum
+{
+    BUS_PRIORITY_BULK = 0,      // EEPROM page writes, firmware blobs
+    BUS_PRIORITY_NORMAL = 1,    // configuration and polling
+    BUS_PRIORITY_URGENT = 2,    // interrupt service reads, output writes
+} BusPriority_t;
+
+typedef struct
+{
+    uint32_t transactions;      // granted acquisitions
+    uint32_t preemptions;       // times yield() handed the bus away
+    uint64_t wait_total_us;     // accumulated time spent waiting for the bus
+    uint32_t wait_max_us;       // worst single wait
+} BusClientStats_t;
+
+/**
+ * @brief Priority arbiter for an I2C::I2CMaster shared by several drivers.
+ *
+ * Every client wraps each bus transaction in acquire()/release(). When the
+ * bus is released it is handed to the highest priority waiter, FIFO within
+ * a priority. Bulk clients split long transfers at transaction boundaries
+ * (e.g. EEPROM pages) and call yield() between them so urgent traffic only
+ * ever waits for one transaction.
+ *
+ * While a task waits, the owner inherits the waiter's RTOS priority until it
+ * releases the bus, so a preempted low priority owner cannot stall a high
+ * priority waiter behind unrelated tasks. The owner's base priority is read
+ * from the kernel, which needs FreeRTOS 11 or configUSE_TRACE_FACILITY;
+ * without either, owners are never boosted.
+ */
+
+class BusScheduler
+{
+public:
+    /**
+     * @brief Constructor.
+     */
+    BusScheduler();
+
+    /**
+     * @brief Destructor.
+     */
+    ~BusScheduler();
+
+    /**
+     * @brief Register a bus client.
+     *
+     * @param[in]  name Client name, must stay valid.
+     * @param[out] id   Client id used in the other calls.
+     *
+     * @return
+     */
+    esp_err_t add_client(const char *name, int *id);
+
+    /**
+     * @brief Block until the bus is granted to the client.
+     *
+     * @param[in] id        Client id.
+     * @param[in] priority  Priority of the upcoming transaction.
+     *
+     * @return
+     */
+    esp_err_t acquire(int id, BusPriority_t priority);
+
+    /**
+     * @brief Release the bus, handing it to the next waiter.
+     *
+     * Must be called from the task that acquired the bus.
+     *
+     * @param[in] id    Client id, must be the current owner.
+     *
+     * @return
+     */
+    esp_err_t release(int id);
+
+    /**
+     * @brief Check whether a higher priority client is waiting for the bus.
+     *
+     * @param[in] id    Client id, must be the current owner.
+     */
+    bool should_yield(int id);
+
+    /**
+     * @brief Hand the bus to higher priority waiters and re-acquire it.
+     *
+     * Call between the transactions of a split bulk transfer.
+     *
+     * @param[in] id    Client id, must be the current owner.
+     *
+     * @return
+     */
+    esp_err_t yield(int id);
+
+    /**
+     * @brief Read a client's wait statistics.
+     *
+     * @param[in]  id       Client id.
+     * @param[out] stats    Statistics snapshot.
+     *
+     * @return
+     */
+    esp_err_t read_stats(int id, BusClientStats_t *stats);
+
+private:
+    typedef struct
+    {
+        const char *name;
+        SemaphoreHandle_t wake;
+        BusPriority_t priority;
+        bool waiting;
+        uint32_t seq;
+        TaskHandle_t task;
+        UBaseType_t task_priority;
+        BusClientStats_t stats;
+    } Client_t;
+
+    bool is_client_valid(int id);
+    void grant(int id, TaskHandle_t task, BusPriority_t priority);
+    void boost(UBaseType_t task_priority);
+    void unboost();
+    void record_wait(Client_t *client, int64_t start);
+
+    SemaphoreHandle_t m_lock;
+    Client_t m_clients[BUS_SCHEDULER_MAX_CLIENTS];
+    int m_client_count;
+    int m_owner;
+    BusPriority_t m_owner_priority;
+    TaskHandle_t m_owner_task;
+    bool m_owner_boosted;
+    UBaseType_t m_owner_base_priority;
+    uint32_t m_seq;
+};
+
+} // namespace BusScheduler
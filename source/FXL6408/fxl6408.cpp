@@ -19,6 +19,14 @@
  ******************************************************************************/
 
 #include "FXL6408/fxl6408.hpp"
+#include "FXL6408/fxl6408_encoder.hpp"
+#include "BusScheduler/bus_scheduler.hpp"
+#include "FXL6408/fxl6408_capture.hpp"
+
+#include <string.h>
+#include <stddef.h>
+
+#include "esp_timer.h"
 
 namespace GpioExpander
 {
@@ -32,27 +40,6 @@ namespace GpioExpander
 #define FXL6408_ADDRESS_WRITE_0             0x86
 #define FXL6408_ADDRESS_READ_0              0x87
 
-#define FXL6408_ADDRESS_UID_CTRL            0x01 // R/W
-#define FXL6408_ADDRESS_IO_DIR              0x03 // R/W
-#define FXL6408_ADDRESS_OUT_STATE           0x05 // R/W
-#define FXL6408_ADDRESS_OUT_HIGHZ           0x07 // R/W
-#define FXL6408_ADDRESS_IN_DEFAULT_STATE    0x09 // R/W
-#define FXL6408_ADDRESS_PU_EN               0x0B // R/W
-#define FXL6408_ADDRESS_PU_PD               0x0D // R/W
-#define FXL6408_ADDRESS_IN_STATUS           0x0F // R
-#define FXL6408_ADDRESS_IT_MASK             0x11 // R/W
-#define FXL6408_ADDRESS_IT_STATUS           0x13 // R/W
-
-#define FXL6408_ADDRESS_RESERVED_1          0x02
-#define FXL6408_ADDRESS_RESERVED_2          0x04
-#define FXL6408_ADDRESS_RESERVED_3          0x06
-#define FXL6408_ADDRESS_RESERVED_4          0x08
-#define FXL6408_ADDRESS_RESERVED_5          0x0A
-#define FXL6408_ADDRESS_RESERVED_6          0x0C
-#define FXL6408_ADDRESS_RESERVED_7          0x0E
-#define FXL6408_ADDRESS_RESERVED_8          0x10
-#define FXL6408_ADDRESS_RESERVED_9          0x12
-
 static const char *TAG = "GPIO EXPANDER";
 
 static TaskHandle_t thread = nullptr;
@@ -73,13 +60,22 @@ void gpio_expander_task(void *args)
 
     for (;;)
     {
-        uint32_t event = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t event = ulTaskNotifyTake(pdTRUE, expander->fxl6408_storm_wait());
+
+        if (expander->m_throttled != 0) expander->fxl6408_sample_throttled();
+        if (event == 0) continue;
 
         uint8_t status = 0;
         esp_err_t err = expander->fxl6408_read_it_status(&status);
 
+        if ((status & expander->m_encoder_mask) != 0) expander->fxl6408_update_encoders();
+        if (expander->m_storm_enabled) expander->fxl6408_track_storms(status);
+
         for (uint16_t gpio = 0x01; gpio <= 0x80; gpio = gpio << 1)
-            if ((status & gpio) == gpio) xTaskNotify(*m_tasks[bit_to_gpio(gpio)], 0x01, eSetBits);
+        {
+            TaskHandle_t *task = m_tasks[bit_to_gpio(gpio)];
+            if ((status & gpio) == gpio && task != NULL) xTaskNotify(*task, 0x01, eSetBits);
+        }
     }
 }
 
@@ -157,9 +153,42 @@ esp_err_t gpio_expander_is_gpio_valid(GpioExpanderEnum_t gpio)
 GpioExpander::GpioExpander()
 {
     m_addr = 0;
+    m_cache_valid = 0;
+    m_verify_policy = GPIO_EXPANDER_VERIFY_ALWAYS;
+    m_verify_period = 1;
+    m_verify_count = 0;
+    m_verify_pending = 0;
+    m_verify_stats = {};
+    m_mutex = NULL;
+    m_pulse_timer = NULL;
+    m_pulse_task = NULL;
+    m_pulse_callbacks = 0;
+    m_pulse_active = 0;
+    m_pulse_level = 0;
+    m_bus = NULL;
+    m_bus_client = NULL;
+    m_bus_id = -1;
+    m_capture_lock = portMUX_INITIALIZER_UNLOCKED;
+    m_capture_buffer = NULL;
+    m_capture_size = 0;
+    m_capture_length = 0;
+    m_capture_start = 0;
+    m_capture_dropped = 0;
+    m_encoder_count = 0;
+    m_encoder_mask = 0;
+    m_storm_enabled = false;
+    m_storm = {};
+    m_storm_sampled = 0;
+    m_throttled = 0;
+    m_throttled_level = 0;
     
     for (uint8_t idx = 0; idx <= 7; idx++)
+    {
         m_tasks[idx] = NULL;
+        m_storm_count[idx] = 0;
+        m_pulse_deadline[idx] = 0;
+        m_pulse_period[idx] = 0;
+    }
 }
 
 esp_err_t GpioExpander::init(I2C::I2CMaster *i2c, int rst, int it, int addr)
@@ -169,6 +198,9 @@ esp_err_t GpioExpander::init(I2C::I2CMaster *i2c, int rst, int it, int addr)
     m_it = it;
     m_addr = addr;
 
+    if (m_mutex == NULL) m_mutex = xSemaphoreCreateRecursiveMutex();
+    if (m_mutex == NULL) return ESP_ERR_NO_MEM;
+
     if (m_addr == 1)
     {
         m_addr_read = FXL6408_ADDRESS_READ_1;
@@ -208,329 +240,551 @@ esp_err_t GpioExpander::init(I2C::I2CMaster *i2c, int rst, int it, int addr)
 
 esp_err_t GpioExpander::deinit()
 {
+    Lock lock(m_mutex);
+
+    if (m_pulse_timer != NULL)
+    {
+        esp_timer_stop(m_pulse_timer);
+        esp_timer_delete(m_pulse_timer);
+        m_pulse_timer = NULL;
+        m_pulse_active = 0;
+    }
+
+    // a callback that fired before the delete may still be notifying the task
+    TaskHandle_t task = m_pulse_task.exchange(NULL);
+
+    while (m_pulse_callbacks.load() != 0) vTaskDelay(1);
+
+    // the task wakes, sees it was unregistered and deletes itself
+    if (task != NULL) xTaskNotifyGive(task);
+
     return m_i2c->deinit();
 }
 
-esp_err_t GpioExpander::fxl6408_read_ctrl(uint8_t *data)
+esp_err_t GpioExpander::fxl6408_set_bus_scheduler(BusScheduler::BusScheduler *bus)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_UID_CTRL, data, 1);
-    if (err != ESP_OK) printf("failed to read ctrl from addr %Xh\r\n", FXL6408_ADDRESS_UID_CTRL);
+    // every bus access runs under the device lock, so none is in flight here
+    Lock lock(m_mutex);
 
-    return err;
+    if (bus != NULL && bus != m_bus_client)
+    {
+        int id = -1;
+
+        esp_err_t err = bus->add_client("fxl6408", &id);
+        if (err != ESP_OK) return err;
+
+        m_bus_client = bus;
+        m_bus_id = id;
+    }
+
+    m_bus = bus;
+
+    return ESP_OK;
 }
 
-esp_err_t GpioExpander::fxl6408_software_reset()
+esp_err_t GpioExpander::fxl6408_read_bus_stats(BusScheduler::BusClientStats_t *stats)
 {
-    uint8_t data = 0;
+    Lock lock(m_mutex);
 
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_UID_CTRL, &data, 1);
-    if (err != ESP_OK)
+    if (m_bus == NULL) return ESP_ERR_INVALID_STATE;
+
+    return m_bus->read_stats(m_bus_id, stats);
+}
+
+/*
+ * Interrupt service registers and the output path are latency critical,
+ * everything else is configuration traffic.
+ */
+static BusScheduler::BusPriority_t bus_priority(uint8_t reg)
+{
+    switch (reg)
     {
-        printf("failed to read ctrl from addr %Xh\r\n", FXL6408_ADDRESS_UID_CTRL);
-        return err;
+        case FXL6408_ADDRESS_OUT_STATE:
+        case FXL6408_ADDRESS_IN_STATUS:
+        case FXL6408_ADDRESS_IT_STATUS:
+            return BusScheduler::BUS_PRIORITY_URGENT;
+        default:
+            return BusScheduler::BUS_PRIORITY_NORMAL;
+    }
+}
+
+esp_err_t GpioExpander::fxl6408_bus_read(uint8_t reg, uint8_t *data, size_t len)
+{
+    // the release must match the acquire even if the scheduler is swapped
+    BusScheduler::BusScheduler *bus = m_bus;
+
+    if (bus != NULL)
+    {
+        esp_err_t err = bus->acquire(m_bus_id, bus_priority(reg));
+        if (err != ESP_OK) return err;
     }
 
-    data = data + 0x01;
+    bool capture = m_capture_buffer != NULL;
+    int64_t start = capture ? esp_timer_get_time() : 0;
+
+    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, reg, data, len);
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_UID_CTRL, &data, 1);
-    if (err != ESP_OK) printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_UID_CTRL);
+    if (capture)
+        fxl6408_capture(reg, err != ESP_OK ? FXL6408_CAPTURE_FLAG_ERROR : 0, data, len,
+                        start, esp_timer_get_time());
+
+    if (bus != NULL) bus->release(m_bus_id);
 
     return err;
 }
 
-esp_err_t GpioExpander::fxl6408_read_io_dir(uint8_t *dir)
+esp_err_t GpioExpander::fxl6408_bus_write(uint8_t reg, uint8_t *data, size_t len)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_IO_DIR, dir, 1);
-    if (err == ESP_OK) printf("read_dir %u\r\n", *dir);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_IO_DIR);
+    // the release must match the acquire even if the scheduler is swapped
+    BusScheduler::BusScheduler *bus = m_bus;
+
+    if (bus != NULL)
+    {
+        esp_err_t err = bus->acquire(m_bus_id, bus_priority(reg));
+        if (err != ESP_OK) return err;
+    }
+
+    bool capture = m_capture_buffer != NULL;
+    int64_t start = capture ? esp_timer_get_time() : 0;
+
+    esp_err_t err = m_i2c->write_byte(m_addr_write, reg, data, len);
+
+    if (capture)
+        fxl6408_capture(reg, FXL6408_CAPTURE_FLAG_WRITE | (err != ESP_OK ? FXL6408_CAPTURE_FLAG_ERROR : 0),
+                        data, len, start, esp_timer_get_time());
+
+    if (bus != NULL) bus->release(m_bus_id);
 
     return err;
 }
 
-esp_err_t GpioExpander::fxl6408_set_io_dir(uint8_t gpio, uint8_t dir)
+esp_err_t GpioExpander::fxl6408_capture_start(uint8_t *buffer, size_t size)
 {
-    uint8_t read_dir = 0;
-
-    esp_err_t err = fxl6408_read_io_dir(&read_dir);
-    
-    uint8_t new_dir = read_dir;
+    if (buffer == NULL || size < sizeof(Fxl6408CaptureHeader_t)) return ESP_ERR_INVALID_ARG;
 
-    if ((new_dir & gpio) != dir)
-        new_dir = dir == FXL6408_GPIO_MODE_INPUT ? new_dir - gpio : new_dir + gpio;
+    Fxl6408CaptureHeader_t header = {};
+    header.magic = FXL6408_CAPTURE_MAGIC;
+    header.version = FXL6408_CAPTURE_VERSION;
+    header.addr = m_addr_write >> 1;
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_IO_DIR, &new_dir, 1);
-    if (err == ESP_OK) printf("wrote new_dir %u\r\n", new_dir);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_IO_DIR);
+    memcpy(buffer, &header, sizeof(header));
 
-    read_dir = 0;
+    taskENTER_CRITICAL(&m_capture_lock);
 
-    err = fxl6408_read_io_dir(&read_dir);
+    m_capture_size = size;
+    m_capture_length = sizeof(header);
+    m_capture_dropped = 0;
+    m_capture_start = esp_timer_get_time();
+    m_capture_buffer = buffer;
 
-    if (read_dir != new_dir)
-    {
-        printf("read_dir %u != new_dir %u\r\n", read_dir, new_dir);
-        return ESP_FAIL;
-    }
+    taskEXIT_CRITICAL(&m_capture_lock);
 
     return ESP_OK;
 }
 
-esp_err_t GpioExpander::fxl6408_read_io_level(uint8_t *output)
+esp_err_t GpioExpander::fxl6408_capture_stop(size_t *length)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_OUT_STATE, output, 1);
-    if (err == ESP_OK) printf("output %u\r\n", *output);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_OUT_STATE);
+    if (m_capture_buffer == NULL) return ESP_ERR_INVALID_STATE;
 
-    return err;
-}
+    taskENTER_CRITICAL(&m_capture_lock);
 
-esp_err_t GpioExpander::fxl6408_set_io_level(uint8_t gpio, uint8_t output)
-{
-    esp_err_t err = fxl6408_set_io_highz(gpio, FXL6408_GPIO_LEVEL_NO_HIGHZ);
+    uint8_t *buffer = m_capture_buffer;
+    m_capture_buffer = NULL;
 
-    uint8_t read_output = 0;
+    taskEXIT_CRITICAL(&m_capture_lock);
 
-    err = fxl6408_read_io_level(&read_output);
-    if (err != ESP_OK) return err;
+    memcpy(buffer + offsetof(Fxl6408CaptureHeader_t, dropped), &m_capture_dropped, sizeof(m_capture_dropped));
+    *length = m_capture_length;
 
-    uint8_t new_output = read_output;
+    return ESP_OK;
+}
 
-    if ((new_output & gpio) != output)
-        new_output = output == FXL6408_GPIO_LEVEL_LOW ? new_output - gpio : new_output + gpio;
+void GpioExpander::fxl6408_capture(uint8_t reg, uint8_t flags, const uint8_t *data, size_t len,
+                                   int64_t start, int64_t end)
+{
+    Fxl6408CaptureRecord_t record = {};
+    record.duration_us = end - start > 0xFFFF ? 0xFFFF : (uint16_t) (end - start);
+    record.reg = reg;
+    record.flags = flags;
+    record.len = len;
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_OUT_STATE, &new_output, 1);
-    if (err == ESP_OK) printf("wrote new_output %u\r\n", new_output);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_OUT_STATE);
+    taskENTER_CRITICAL(&m_capture_lock);
 
-    read_output = 0;
+    // the capture stopped, or was (re)started while this transfer was on the bus
+    if (m_capture_buffer == NULL || start < m_capture_start)
+    {
+        taskEXIT_CRITICAL(&m_capture_lock);
+        return;
+    }
 
-    err = fxl6408_read_io_level(&read_output);
-    if (err != ESP_OK) return err;
+    record.start_us = (uint64_t) (start - m_capture_start);
 
-    if (read_output != new_output)
+    if (m_capture_length + sizeof(record) + len > m_capture_size)
+        m_capture_dropped++;
+    else
     {
-        printf("read_output %u != new_output %u\r\n", read_output, new_output);
-        return ESP_FAIL;
+        memcpy(m_capture_buffer + m_capture_length, &record, sizeof(record));
+        if (len > 0) memcpy(m_capture_buffer + m_capture_length + sizeof(record), data, len);
+        m_capture_length += sizeof(record) + len;
     }
 
-    return ESP_OK;
+    taskEXIT_CRITICAL(&m_capture_lock);
 }
 
-esp_err_t GpioExpander::fxl6408_read_io_highz(uint8_t *highz)
+/*
+ * Setters take a FXL6408_GPIO_x mask and a 0/1 value for every pin in it.
+ */
+static uint8_t value_to_bits(uint8_t value)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_OUT_HIGHZ, highz, 1);
-    if (err == ESP_OK) printf("highz %u\r\n", *highz);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_OUT_HIGHZ);
-
-    return err;
+    return value ? 0xFF : 0x00;
 }
 
-esp_err_t GpioExpander::fxl6408_set_io_highz(uint8_t gpio, uint8_t highz)
+esp_err_t GpioExpander::fxl6408_reg_read(Fxl6408Reg_t reg, uint8_t *data)
 {
-    uint8_t read_highz = 0;
+    Lock lock(m_mutex);
 
-    esp_err_t err = fxl6408_read_io_highz(&read_highz);
-    if (err != ESP_OK) return err;
-
-    uint8_t new_highz = read_highz;
-
-    if ((new_highz & gpio) != highz)
-        new_highz = highz == FXL6408_GPIO_LEVEL_LOW ? new_highz - gpio : new_highz + gpio;
+    const Fxl6408Register_t *desc = &fxl6408_registers[reg];
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_OUT_HIGHZ, &new_highz, 1);
-    if (err == ESP_OK) printf("wrote new_highz %u\r\n", new_highz);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_OUT_HIGHZ);
-
-    read_highz = 0;
+    esp_err_t err = fxl6408_bus_read(desc->addr, data, 1);
+    if (err != ESP_OK)
+    {
+        printf("failed to read addr %Xh\r\n", desc->addr);
+        m_cache_valid &= ~(1 << reg);
+        return err;
+    }
 
-    err = fxl6408_read_io_highz(&read_highz);
-    if (err != ESP_OK) return err;
+    ESP_LOGD(TAG, "%s %u", desc->name, *data);
 
-    if (read_highz != new_highz)
+    if (desc->cacheable)
     {
-        printf("read_highz %u != new_highz %u\r\n", read_highz, new_highz);
-        return ESP_FAIL;
+        m_cache[reg] = *data;
+        m_cache_valid |= 1 << reg;
     }
 
     return ESP_OK;
 }
 
-esp_err_t GpioExpander::fxl6408_read_input_state(uint8_t *input)
+esp_err_t GpioExpander::fxl6408_reg_write(Fxl6408Reg_t reg, uint8_t data, GpioExpanderVerify_t verify)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_IN_DEFAULT_STATE, input, 1);
-    if (err == ESP_OK) printf("input %u\r\n", *input);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_IN_DEFAULT_STATE);
+    Lock lock(m_mutex);
 
-    return err;
-}
+    const Fxl6408Register_t *desc = &fxl6408_registers[reg];
 
-esp_err_t GpioExpander::fxl6408_set_input_state(uint8_t gpio, uint8_t state)
-{
-    uint8_t read_state = 0;
+    esp_err_t err = fxl6408_bus_write(desc->addr, &data, 1);
+    if (err != ESP_OK)
+    {
+        printf("failed to write to addr %Xh\r\n", desc->addr);
+        m_cache_valid &= ~(1 << reg);
+        return err;
+    }
 
-    esp_err_t err = fxl6408_read_input_state(&read_state);
-    if (err != ESP_OK) return err;
+    ESP_LOGD(TAG, "wrote %s %u", desc->name, data);
 
-    uint8_t new_state = read_state;
+    if (desc->cacheable)
+    {
+        m_cache[reg] = data;
+        m_cache_valid |= 1 << reg;
+    }
 
-    if ((new_state & gpio) != state)
-        new_state = state == FXL6408_GPIO_NO_MASK ? new_state - gpio : new_state + gpio;
+    m_verify_stats.writes++;
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_IN_DEFAULT_STATE, &new_state, 1);
-    if (err == ESP_OK) printf("wrote new_state %u\r\n", new_state);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_IN_DEFAULT_STATE);
+    // unverified writes (pulses, encoder re-arm, storm masking) move the target too
+    if (m_verify_pending & (1 << reg)) m_verify_expected[reg] = data;
 
-    read_state = 0;
+    if (desc->verify_mask == 0) return ESP_OK;
 
-    err = fxl6408_read_input_state(&read_state);
+    switch (fxl6408_verify_mode(verify))
+    {
+        case GPIO_EXPANDER_VERIFY_DEFERRED:
+        {
+            m_verify_expected[reg] = data;
+            m_verify_pending |= 1 << reg;
+            m_verify_stats.deferred++;
+            return ESP_OK;
+        }
+        case GPIO_EXPANDER_VERIFY_ALWAYS:
+            break;
+        default:
+            return ESP_OK;
+    }
+
+    uint8_t read_data = 0;
+
+    err = fxl6408_reg_read(reg, &read_data);
     if (err != ESP_OK) return err;
 
-    if (read_state != new_state)
+    m_verify_stats.verified++;
+    m_verify_pending &= ~(1 << reg);
+
+    if ((read_data ^ data) & desc->verify_mask)
     {
-        printf("read_state %u != new_state %u\r\n", read_state, new_state);
+        m_verify_stats.mismatches++;
+        printf("read %s %u != new %s %u\r\n", desc->name, read_data, desc->name, data);
         return ESP_FAIL;
     }
 
     return ESP_OK;
 }
 
-esp_err_t GpioExpander::fxl6408_read_pu_en(uint8_t *pu_en)
+/*
+ * Resolve a per-call request against the device policy. Sampled policies
+ * turn into ALWAYS once every m_verify_period writes and NONE otherwise.
+ */
+GpioExpanderVerify_t GpioExpander::fxl6408_verify_mode(GpioExpanderVerify_t verify)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_PU_EN, pu_en, 1);
-    if (err == ESP_OK) printf("pu_en %u\r\n", *pu_en);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_PU_EN);
+    if (verify == GPIO_EXPANDER_VERIFY_DEFAULT) verify = m_verify_policy;
+    if (verify != GPIO_EXPANDER_VERIFY_SAMPLED) return verify;
 
-    return err;
+    if (++m_verify_count < m_verify_period) return GPIO_EXPANDER_VERIFY_NONE;
+
+    m_verify_count = 0;
+
+    return GPIO_EXPANDER_VERIFY_ALWAYS;
 }
 
-esp_err_t GpioExpander::fxl6408_set_pu_en(uint8_t gpio, uint8_t en)
+esp_err_t GpioExpander::fxl6408_set_verify_policy(GpioExpanderVerify_t policy, uint16_t sample_period)
 {
-    uint8_t read_en = 0;
+    if (policy == GPIO_EXPANDER_VERIFY_DEFAULT || policy > GPIO_EXPANDER_VERIFY_DEFERRED)
+        return ESP_ERR_INVALID_ARG;
+    if (sample_period == 0) return ESP_ERR_INVALID_ARG;
 
-    esp_err_t err = fxl6408_read_pu_en(&read_en);
-    if (err != ESP_OK) return err;
+    Lock lock(m_mutex);
 
-    uint8_t new_en = read_en;
+    m_verify_policy = policy;
+    m_verify_period = sample_period;
+    m_verify_count = 0;
 
-    if ((new_en & gpio) != en)
-        new_en = en == FXL6408_GPIO_PUPD_DISABLE ? new_en - gpio : new_en + gpio;
+    return ESP_OK;
+}
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_PU_EN, &new_en, 1);
-    if (err == ESP_OK) printf("wrote new_en %u\r\n", new_en);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_PU_EN);
+/*
+ * The FXL6408 auto-increments the register address, so every pending
+ * register is checked with one read spanning the lowest to the highest.
+ * Only RW registers can be pending, so the span stops before IT_STATUS and
+ * never clears a pending interrupt.
+ */
+esp_err_t GpioExpander::fxl6408_verify_pending()
+{
+    Lock lock(m_mutex);
 
-    read_en = 0;
+    if (m_verify_pending == 0) return ESP_OK;
 
-    err = fxl6408_read_pu_en(&read_en);
-    if (err != ESP_OK) return err;
+    uint8_t first = FXL6408_REG_COUNT;
+    uint8_t last = 0;
 
-    if (read_en != new_en)
+    for (uint8_t reg = 0; reg < FXL6408_REG_COUNT; reg++)
     {
-        printf("read_en %u != new_en %u\r\n", read_en, new_en);
-        return ESP_FAIL;
+        if ((m_verify_pending & (1 << reg)) == 0) continue;
+
+        if (first == FXL6408_REG_COUNT) first = reg;
+        last = reg;
     }
 
-    return ESP_OK;
-}
+    uint8_t base = fxl6408_registers[first].addr;
+    uint8_t data[fxl6408_registers[FXL6408_REG_COUNT - 1].addr + 1] = {};
 
-esp_err_t GpioExpander::fxl6408_read_pu_pd(uint8_t *pu_pd)
-{
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_PU_PD, pu_pd, 1);
-    if (err == ESP_OK) printf("pu_pd %u\r\n", *pu_pd);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_PU_PD);
+    esp_err_t err = fxl6408_bus_read(base, data, fxl6408_registers[last].addr - base + 1);
+    if (err != ESP_OK)
+    {
+        printf("failed to read addr %Xh\r\n", base);
+        return err;
+    }
 
-    return err;
+    bool ok = true;
+
+    for (uint8_t reg = first; reg <= last; reg++)
+    {
+        if ((m_verify_pending & (1 << reg)) == 0) continue;
+
+        const Fxl6408Register_t *desc = &fxl6408_registers[reg];
+        uint8_t read_data = data[desc->addr - base];
+
+        m_verify_stats.verified++;
+
+        if (desc->cacheable)
+        {
+            m_cache[reg] = read_data;
+            m_cache_valid |= 1 << reg;
+        }
+
+        if (((read_data ^ m_verify_expected[reg]) & desc->verify_mask) == 0) continue;
+
+        m_verify_stats.mismatches++;
+        printf("read %s %u != new %s %u\r\n", desc->name, read_data, desc->name, m_verify_expected[reg]);
+        ok = false;
+    }
+
+    m_verify_pending = 0;
+
+    return ok ? ESP_OK : ESP_FAIL;
 }
 
-esp_err_t GpioExpander::fxl6408_set_pu_pd(uint8_t gpio, uint8_t pu_pd)
+esp_err_t GpioExpander::fxl6408_read_verify_stats(GpioExpanderVerifyStats_t *stats)
 {
-    uint8_t read_pu_pd = 0;
+    Lock lock(m_mutex);
 
-    esp_err_t err = fxl6408_read_pu_en(&read_pu_pd);
-    if (err != ESP_OK) return err;
+    *stats = m_verify_stats;
 
-    uint8_t new_pu_pd = read_pu_pd;
+    return ESP_OK;
+}
 
-    if ((new_pu_pd & gpio) != pu_pd)
-        new_pu_pd = pu_pd == FXL6408_GPIO_PUPD_DISABLE ? new_pu_pd - gpio : new_pu_pd + gpio;
+esp_err_t GpioExpander::fxl6408_reg_update(Fxl6408Reg_t reg, uint8_t mask, uint8_t value, GpioExpanderVerify_t verify)
+{
+    Lock lock(m_mutex);
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_PU_EN, &new_pu_pd, 1);
-    if (err == ESP_OK) printf("wrote new_pu_pd %u\r\n", new_pu_pd);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_PU_EN);
+    const Fxl6408Register_t *desc = &fxl6408_registers[reg];
+    bool cached = (m_cache_valid & (1 << reg)) != 0;
+    uint8_t cache = m_cache[reg];
+    uint8_t data = cache;
 
-    read_pu_pd = 0;
+    if (verify == GPIO_EXPANDER_VERIFY_DEFAULT) verify = m_verify_policy;
 
-    err = fxl6408_read_pu_en(&read_pu_pd);
-    if (err != ESP_OK) return err;
+    // under ALWAYS the cache is checked too, a device that reset itself must not be missed
+    if (!cached || verify == GPIO_EXPANDER_VERIFY_ALWAYS)
+    {
+        esp_err_t err = fxl6408_reg_read(reg, &data);
+        if (err != ESP_OK) return err;
+    }
 
-    if (read_pu_pd != new_pu_pd)
+    if (cached && verify == GPIO_EXPANDER_VERIFY_ALWAYS)
     {
-        printf("read_pu_pd %u != new_pu_pd %u\r\n", read_pu_pd, new_pu_pd);
-        return ESP_FAIL;
+        m_verify_stats.verified++;
+
+        if ((data ^ cache) & desc->verify_mask)
+        {
+            m_verify_stats.mismatches++;
+            printf("read %s %u != cached %s %u\r\n", desc->name, data, desc->name, cache);
+        }
     }
 
-    return ESP_OK;
+    uint8_t new_data = (data & ~mask) | (value & mask);
+    if (new_data == data) return ESP_OK;
+
+    return fxl6408_reg_write(reg, new_data, verify);
 }
 
-esp_err_t GpioExpander::fxl6408_read_input_status(uint8_t *status)
+esp_err_t GpioExpander::fxl6408_read_ctrl(uint8_t *data)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_IN_STATUS, status, 1);
-    if (err == ESP_OK) printf("status %u\r\n", *status);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_IN_STATUS);
+    return reg_read<FXL6408_REG_UID_CTRL>(data);
+}
+
+esp_err_t GpioExpander::fxl6408_software_reset()
+{
+    Lock lock(m_mutex);
+
+    uint8_t data = 0;
+
+    esp_err_t err = reg_read<FXL6408_REG_UID_CTRL>(&data);
+    if (err != ESP_OK) return err;
+
+    // SW_RST self-clears and restores every register to its reset value
+    err = reg_write<FXL6408_REG_UID_CTRL>(data | FXL6408_UID_CTRL_SW_RST, GPIO_EXPANDER_VERIFY_NONE);
+    m_cache_valid = 0;
+    m_verify_pending = 0;
 
     return err;
 }
 
-esp_err_t GpioExpander::fxl6408_read_it_mask(uint8_t *mask)
+esp_err_t GpioExpander::fxl6408_read_io_dir(uint8_t *dir)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_IT_MASK, mask, 1);
-    if (err == ESP_OK) printf("mask %u\r\n", *mask);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_IT_MASK);
+    return reg_read<FXL6408_REG_IO_DIR>(dir);
+}
 
-    return err;
+esp_err_t GpioExpander::fxl6408_set_io_dir(uint8_t gpio, uint8_t dir,
+                                           GpioExpanderVerify_t verify)
+{
+    return reg_update<FXL6408_REG_IO_DIR>(gpio, value_to_bits(dir), verify);
 }
 
-esp_err_t GpioExpander::fxl6408_set_it_mask(uint8_t gpio, uint8_t mask)
+esp_err_t GpioExpander::fxl6408_read_io_level(uint8_t *output)
 {
-    uint8_t read_mask = 0;
+    return reg_read<FXL6408_REG_OUT_STATE>(output);
+}
+
+esp_err_t GpioExpander::fxl6408_set_io_level(uint8_t gpio, uint8_t output,
+                                             GpioExpanderVerify_t verify)
+{
+    // HIGHZ and OUT_STATE change together, the pulse task must not write in between
+    Lock lock(m_mutex);
 
-    esp_err_t err = fxl6408_read_it_mask(&read_mask);
+    esp_err_t err = fxl6408_set_io_highz(gpio, FXL6408_GPIO_LEVEL_NO_HIGHZ, verify);
     if (err != ESP_OK) return err;
 
-    uint8_t new_mask = read_mask;
+    return reg_update<FXL6408_REG_OUT_STATE>(gpio, value_to_bits(output), verify);
+}
 
-    if ((new_mask & gpio) != mask)
-        new_mask = mask == FXL6408_GPIO_NO_MASK ? new_mask - gpio : new_mask + gpio;
+esp_err_t GpioExpander::fxl6408_read_io_highz(uint8_t *highz)
+{
+    return reg_read<FXL6408_REG_OUT_HIGHZ>(highz);
+}
 
-    err = m_i2c->write_byte(m_addr_write, FXL6408_ADDRESS_IT_MASK, &new_mask, 1);
-    if (err == ESP_OK) printf("wrote new_mask %u\r\n", new_mask);
-    else printf("failed to write to addr %Xh\r\n", FXL6408_ADDRESS_IT_MASK);
+esp_err_t GpioExpander::fxl6408_set_io_highz(uint8_t gpio, uint8_t highz,
+                                             GpioExpanderVerify_t verify)
+{
+    return reg_update<FXL6408_REG_OUT_HIGHZ>(gpio, value_to_bits(highz), verify);
+}
 
-    read_mask = 0;
+esp_err_t GpioExpander::fxl6408_read_input_state(uint8_t *input)
+{
+    return reg_read<FXL6408_REG_IN_DEFAULT_STATE>(input);
+}
 
-    err = fxl6408_read_it_mask(&read_mask);
-    if (err != ESP_OK) return err;
+esp_err_t GpioExpander::fxl6408_set_input_state(uint8_t gpio, uint8_t state,
+                                                GpioExpanderVerify_t verify)
+{
+    return reg_update<FXL6408_REG_IN_DEFAULT_STATE>(gpio, value_to_bits(state), verify);
+}
 
-    if (read_mask != new_mask)
-    {
-        printf("read_mask %u != new_mask %u\r\n", read_mask, new_mask);
-        return ESP_FAIL;
-    }
+esp_err_t GpioExpander::fxl6408_read_pu_en(uint8_t *pu_en)
+{
+    return reg_read<FXL6408_REG_PU_EN>(pu_en);
+}
 
-    return ESP_OK;
+esp_err_t GpioExpander::fxl6408_set_pu_en(uint8_t gpio, uint8_t en,
+                                          GpioExpanderVerify_t verify)
+{
+    return reg_update<FXL6408_REG_PU_EN>(gpio, value_to_bits(en), verify);
 }
 
-esp_err_t GpioExpander::fxl6408_read_it_status(uint8_t *status)
+esp_err_t GpioExpander::fxl6408_read_pu_pd(uint8_t *pu_pd)
+{
+    return reg_read<FXL6408_REG_PU_PD>(pu_pd);
+}
+
+esp_err_t GpioExpander::fxl6408_set_pu_pd(uint8_t gpio, uint8_t pu_pd,
+                                          GpioExpanderVerify_t verify)
 {
-    esp_err_t err = m_i2c->read_byte(m_addr_read, m_addr_write, FXL6408_ADDRESS_IT_STATUS, status, 1);
-    if (err == ESP_OK) printf("status %u\r\n", *status);
-    else printf("failed to read addr %Xh\r\n", FXL6408_ADDRESS_IT_STATUS);
+    return reg_update<FXL6408_REG_PU_PD>(gpio, value_to_bits(pu_pd), verify);
+}
 
-    return err;
+esp_err_t GpioExpander::fxl6408_read_input_status(uint8_t *status)
+{
+    return reg_read<FXL6408_REG_IN_STATUS>(status);
+}
+
+esp_err_t GpioExpander::fxl6408_read_it_mask(uint8_t *mask)
+{
+    return reg_read<FXL6408_REG_IT_MASK>(mask);
+}
+
+esp_err_t GpioExpander::fxl6408_set_it_mask(uint8_t gpio, uint8_t mask,
+                                            GpioExpanderVerify_t verify)
+{
+    return reg_update<FXL6408_REG_IT_MASK>(gpio, value_to_bits(mask), verify);
+}
+
+esp_err_t GpioExpander::fxl6408_read_it_status(uint8_t *status)
+{
+    return reg_read<FXL6408_REG_IT_STATUS>(status);
 }
 
 esp_err_t GpioExpander::fxl6408_reset()
 {
+    Lock lock(m_mutex);
+
+    bool capture = m_capture_buffer != NULL;
+    int64_t start = capture ? esp_timer_get_time() : 0;
+
     esp_err_t err = gpio_set_level((gpio_num_t) m_rst, LOW);
     if (err != ESP_OK)
     {
@@ -541,6 +795,12 @@ esp_err_t GpioExpander::fxl6408_reset()
     err = gpio_set_level((gpio_num_t) m_rst, HIGH);
     if (err != ESP_OK) printf("failed to set gpio HIGH\r\n");
 
+    // the registers went back to their reset values without any bus traffic
+    if (capture) fxl6408_capture(0, FXL6408_CAPTURE_FLAG_RESET, NULL, 0, start, esp_timer_get_time());
+
+    m_cache_valid = 0;
+    m_verify_pending = 0;
+
     return err;
 }
 
@@ -549,20 +809,237 @@ esp_err_t GpioExpander::fxl6408_set_task(TaskHandle_t *task, GpioExpanderEnum_t
     esp_err_t err = gpio_expander_is_gpio_valid(gpio);
     if (err != ESP_OK) return err;
 
+    err = fxl6408_start_task();
+    if (err != ESP_OK) return err;
+
+    m_tasks[gpio] = task;
+
+    return err;
+}
+
+esp_err_t GpioExpander::fxl6408_attach_encoder(Encoder *encoder)
+{
+    if (encoder == NULL) return ESP_ERR_INVALID_ARG;
+
+    Lock lock(m_mutex);
+
+    if (m_encoder_count >= FXL6408_MAX_ENCODERS) return ESP_ERR_NO_MEM;
+
+    esp_err_t err = gpio_expander_is_gpio_valid(encoder->m_a);
+    if (err != ESP_OK) return err;
+
+    err = gpio_expander_is_gpio_valid(encoder->m_b);
+    if (err != ESP_OK) return err;
+
+    uint8_t mask = encoder->mask();
+    if (encoder->m_a == encoder->m_b || (m_encoder_mask & mask) != 0) return ESP_ERR_INVALID_ARG;
+
+    err = fxl6408_set_io_dir(mask, FXL6408_GPIO_MODE_INPUT);
+    if (err != ESP_OK) return err;
+
+    err = fxl6408_set_it_mask(mask, FXL6408_GPIO_NO_MASK);
+    if (err != ESP_OK) return err;
+
+    uint8_t input = 0;
+
+    err = reg_read<FXL6408_REG_IN_STATUS>(&input);
+    if (err != ESP_OK) return err;
+
+    encoder->seed(input, (uint32_t) esp_timer_get_time());
+
+    m_encoders[m_encoder_count++] = encoder;
+    m_encoder_mask |= mask;
+
+    err = fxl6408_update_encoders();
+    if (err != ESP_OK) return err;
+
+    return fxl6408_start_task();
+}
+
+esp_err_t GpioExpander::fxl6408_start_task()
+{
+    if (thread != nullptr) return ESP_OK;
+
     gpio_install_isr_service(0);
 
     gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
 
-    err = gpio_isr_handler_add((gpio_num_t) m_it, gpio_expander_isr, (void *)m_it);
+    esp_err_t err = gpio_isr_handler_add((gpio_num_t) m_it, gpio_expander_isr, (void *)m_it);
     if (err != ESP_OK) return err;
 
     auto ok = xTaskCreate(gpio_expander_task, "gpio_expander", 2048,
                         static_cast<void *>(this), 10, &thread);
     if (pdPASS != ok) return ESP_ERR_NO_MEM;
 
-    m_tasks[gpio] = task;
+    return ESP_OK;
+}
 
-    return err;
+/*
+ * Decode every attached encoder from a single IN_STATUS read, then move the
+ * encoder bits of IN_DEFAULT_STATE to the levels just sampled. The FXL6408
+ * only interrupts while an input differs from its default state, so this
+ * re-arms the next edge on both channels.
+ */
+esp_err_t GpioExpander::fxl6408_update_encoders()
+{
+    Lock lock(m_mutex);
+
+    uint8_t input = 0;
+
+    esp_err_t err = reg_read<FXL6408_REG_IN_STATUS>(&input);
+    if (err != ESP_OK) return err;
+
+    uint32_t now = (uint32_t) esp_timer_get_time();
+
+    for (uint8_t idx = 0; idx < m_encoder_count; idx++)
+        m_encoders[idx]->update(input, now);
+
+    return reg_update<FXL6408_REG_IN_DEFAULT_STATE>(m_encoder_mask, input, GPIO_EXPANDER_VERIFY_NONE);
+}
+
+esp_err_t GpioExpander::fxl6408_set_storm_protection(const GpioExpanderStormConfig_t *config)
+{
+    Lock lock(m_mutex);
+
+    if (config == NULL)
+    {
+        m_storm_enabled = false;
+
+        esp_err_t err = reg_update<FXL6408_REG_IT_MASK>(m_throttled, 0x00, GPIO_EXPANDER_VERIFY_NONE);
+        if (err == ESP_OK) m_throttled = 0;
+
+        return err;
+    }
+
+    if (config->budget == 0 || config->window_ms == 0 || config->sample_ms == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    m_storm = *config;
+    m_storm_tracker.configure(m_storm.budget, pdMS_TO_TICKS(m_storm.window_ms),
+                              pdMS_TO_TICKS(m_storm.calm_ms), xTaskGetTickCount());
+    m_storm_enabled = true;
+
+    return ESP_OK;
+}
+
+esp_err_t GpioExpander::fxl6408_read_storm_count(GpioExpanderEnum_t gpio, uint32_t *count)
+{
+    esp_err_t err = gpio_expander_is_gpio_valid(gpio);
+    if (err != ESP_OK) return err;
+
+    Lock lock(m_mutex);
+
+    *count = m_storm_count[gpio];
+
+    return ESP_OK;
+}
+
+TickType_t GpioExpander::fxl6408_storm_wait()
+{
+    Lock lock(m_mutex);
+
+    if (m_throttled == 0) return portMAX_DELAY;
+
+    TickType_t elapsed = xTaskGetTickCount() - m_storm_sampled;
+    TickType_t period = pdMS_TO_TICKS(m_storm.sample_ms);
+
+    return elapsed >= period ? 0 : period - elapsed;
+}
+
+/*
+ * Count interrupts per pin within the current window and move pins that go
+ * over budget from IT_MASK driven delivery to polling.
+ */
+void GpioExpander::fxl6408_track_storms(uint8_t status)
+{
+    Lock lock(m_mutex);
+
+    if (!m_storm_enabled) return;
+
+    TickType_t now = xTaskGetTickCount();
+
+    // encoders legitimately interrupt at high rates and are decoded from interrupts only
+    uint8_t over = m_storm_tracker.count(status, m_throttled | m_encoder_mask, now);
+
+    bool sampled = false;
+    uint8_t input = 0;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+    {
+        uint8_t bit = 1 << idx;
+
+        if ((over & bit) == 0) continue;
+
+        // seed the polled level so the first sample does not report a fake change
+        if (!sampled)
+        {
+            if (reg_read<FXL6408_REG_IN_STATUS>(&input) != ESP_OK) continue;
+            sampled = true;
+        }
+
+        if (reg_update<FXL6408_REG_IT_MASK>(bit, bit, GPIO_EXPANDER_VERIFY_NONE) != ESP_OK) continue;
+
+        if (m_throttled == 0) m_storm_sampled = now;
+
+        m_throttled |= bit;
+        m_throttled_level = (m_throttled_level & ~bit) | (input & bit);
+        m_storm_tracker.touch(bit, now);
+        m_storm_count[idx]++;
+
+        ESP_LOGW(TAG, "interrupt storm on IO %u, masking", idx);
+
+        if (m_storm.callback != NULL) m_storm.callback((GpioExpanderEnum_t) idx, true, m_storm.arg);
+    }
+}
+
+/*
+ * Poll masked pins, forward level changes to their tasks and unmask pins
+ * that stayed stable for calm_ms.
+ */
+void GpioExpander::fxl6408_sample_throttled()
+{
+    Lock lock(m_mutex);
+
+    if (m_throttled == 0) return;
+
+    TickType_t now = xTaskGetTickCount();
+
+    if (now - m_storm_sampled < pdMS_TO_TICKS(m_storm.sample_ms)) return;
+
+    m_storm_sampled = now;
+
+    uint8_t input = 0;
+
+    esp_err_t err = reg_read<FXL6408_REG_IN_STATUS>(&input);
+    if (err != ESP_OK) return;
+
+    uint8_t changed = (input ^ m_throttled_level) & m_throttled;
+    m_throttled_level = input;
+
+    m_storm_tracker.touch(changed, now);
+
+    uint8_t calmed = m_storm_tracker.calmed(m_throttled, now);
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+    {
+        uint8_t bit = 1 << idx;
+
+        if ((changed & bit) != 0)
+        {
+            if (m_tasks[idx] != NULL) xTaskNotify(*m_tasks[idx], 0x01, eSetBits);
+            continue;
+        }
+
+        if ((calmed & bit) == 0) continue;
+
+        if (reg_update<FXL6408_REG_IT_MASK>(bit, 0x00, GPIO_EXPANDER_VERIFY_NONE) != ESP_OK) continue;
+
+        m_throttled &= ~bit;
+
+        ESP_LOGI(TAG, "IO %u calmed down, unmasking", idx);
+
+        if (m_storm.callback != NULL) m_storm.callback((GpioExpanderEnum_t) idx, false, m_storm.arg);
+    }
 }
 
 } // namespace GpioExpander
\ No newline at end of file
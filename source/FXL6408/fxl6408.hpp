@@ -20,20 +20,29 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "esp_log.h"
 #include "esp_err.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_timer.h"
 
 #include "../../../I2C/source/I2C/i2c.hpp"
 
+#include "FXL6408/fxl6408_registers.hpp"
+#include "FXL6408/fxl6408_storm.hpp"
+#include "BusScheduler/bus_scheduler.hpp"
+
 namespace GpioExpander
 {
 
 #define FXL6408_GPIO_MODE_INPUT 0
 #define FXL6408_GPIO_MODE_OUTPUT 1
-#define FXL6408_GPIO_0 0x00
+#define FXL6408_GPIO_0 0x01
 #define FXL6408_GPIO_1 0x02
 #define FXL6408_GPIO_2 0x04
 #define FXL6408_GPIO_3 0x08
@@ -66,6 +75,49 @@ typedef enum
     GPIO_EXPANDER_IO_7 = 7,
 } GpioExpanderEnum_t;
 
+#define FXL6408_MAX_ENCODERS 4
+#define FXL6408_PULSE_MERGE_US 50
+#define FXL6408_PULSE_TASK_PRIORITY 12
+
+class Encoder;
+
+typedef enum
+{
+    GPIO_EXPANDER_VERIFY_DEFAULT = 0,   // per-call only, use the device policy
+    GPIO_EXPANDER_VERIFY_NONE,          // trust the bus
+    GPIO_EXPANDER_VERIFY_SAMPLED,       // read back every Nth write
+    GPIO_EXPANDER_VERIFY_ALWAYS,        // read back every write, never skip on the cache
+    GPIO_EXPANDER_VERIFY_DEFERRED,      // batch in fxl6408_verify_pending()
+} GpioExpanderVerify_t;
+
+typedef struct
+{
+    uint32_t writes;                    // register writes issued
+    uint32_t verified;                  // writes or cached values checked against a readback
+    uint32_t mismatches;                // readbacks that differed (written or cached)
+    uint32_t deferred;                  // writes queued for batch verification
+} GpioExpanderVerifyStats_t;
+
+/**
+ * @brief Storm event callback, called from the expander task with the device
+ * lock held.
+ *
+ * @param[in] gpio      Offending expander IO.
+ * @param[in] throttled True when the pin was masked, false when restored.
+ * @param[in] arg       User argument from GpioExpanderStormConfig_t.
+ */
+typedef void (*GpioExpanderStormCallback_t)(GpioExpanderEnum_t gpio, bool throttled, void *arg);
+
+typedef struct
+{
+    uint16_t budget;                        // interrupts allowed per pin and window
+    uint16_t window_ms;                     // rate measurement window
+    uint16_t sample_ms;                     // polling period while a pin is masked
+    uint16_t calm_ms;                       // stable time required before unmasking
+    GpioExpanderStormCallback_t callback;   // optional, may be NULL
+    void *arg;
+} GpioExpanderStormConfig_t;
+
 /**
  * @brief GpioExpander class.
  */
@@ -97,28 +149,245 @@ public:
      */
     esp_err_t deinit();
 
+    /**
+     * @brief Route every bus transaction through a shared bus scheduler.
+     *
+     * Interrupt service reads and OUT_STATE accesses are issued with urgent
+     * priority, configuration traffic with normal priority. The expander
+     * registers as a client once per scheduler.
+     *
+     * @param[in] bus   Scheduler shared with the other I2C drivers, NULL to
+     *                  access the bus directly.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_set_bus_scheduler(BusScheduler::BusScheduler *bus);
+
+    /**
+     * @brief Read the expander's wait statistics on the bus scheduler.
+     *
+     * @param[out] stats    Statistics snapshot.
+     *
+     * @return ESP_ERR_INVALID_STATE when no scheduler is set.
+     */
+    esp_err_t fxl6408_read_bus_stats(BusScheduler::BusClientStats_t *stats);
+
+    /**
+     * @brief Start logging every bus transfer into a capture stream.
+     *
+     * The stream format is described in fxl6408_capture.hpp. Records that do
+     * not fit are dropped and counted in the stream header.
+     *
+     * @param[in] buffer    Capture buffer, must stay valid until stopped.
+     * @param[in] size      Buffer size in bytes.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_capture_start(uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Stop the capture.
+     *
+     * @param[out] length   Number of valid bytes in the capture buffer.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_capture_stop(size_t *length);
+
     esp_err_t fxl6408_read_ctrl(uint8_t *data);
     esp_err_t fxl6408_software_reset();
     esp_err_t fxl6408_read_io_dir(uint8_t *dir);
-    esp_err_t fxl6408_set_io_dir(uint8_t gpio, uint8_t dir);
+    esp_err_t fxl6408_set_io_dir(uint8_t gpio, uint8_t dir,
+                                 GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_io_level(uint8_t *output);
-    esp_err_t fxl6408_set_io_level(uint8_t gpio, uint8_t output);
+    esp_err_t fxl6408_set_io_level(uint8_t gpio, uint8_t output,
+                                   GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_io_highz(uint8_t *highz);
-    esp_err_t fxl6408_set_io_highz(uint8_t gpio, uint8_t highz);
+    esp_err_t fxl6408_set_io_highz(uint8_t gpio, uint8_t highz,
+                                   GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_input_state(uint8_t *input);
-    esp_err_t fxl6408_set_input_state(uint8_t gpio, uint8_t state);
+    esp_err_t fxl6408_set_input_state(uint8_t gpio, uint8_t state,
+                                      GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_pu_en(uint8_t *pu_en);
-    esp_err_t fxl6408_set_pu_en(uint8_t gpio, uint8_t en);
+    esp_err_t fxl6408_set_pu_en(uint8_t gpio, uint8_t en,
+                                GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_pu_pd(uint8_t *pu_pd);
-    esp_err_t fxl6408_set_pu_pd(uint8_t gpio, uint8_t pu_pd);
+    esp_err_t fxl6408_set_pu_pd(uint8_t gpio, uint8_t pu_pd,
+                                GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_input_status(uint8_t *status);
     esp_err_t fxl6408_read_it_mask(uint8_t *mask);
-    esp_err_t fxl6408_set_it_mask(uint8_t gpio, uint8_t mask);
+    esp_err_t fxl6408_set_it_mask(uint8_t gpio, uint8_t mask,
+                                  GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT);
     esp_err_t fxl6408_read_it_status(uint8_t *status);
     esp_err_t fxl6408_reset();
     esp_err_t fxl6408_set_task(TaskHandle_t *task, GpioExpanderEnum_t gpio);
 
+    /**
+     * @brief Attach a quadrature encoder to the interrupt task.
+     *
+     * Configures both encoder pins as unmasked inputs and decodes them from
+     * IN_STATUS on every expander interrupt.
+     *
+     * @param[in] encoder   Encoder object, must outlive the expander.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_attach_encoder(Encoder *encoder);
+
+    /**
+     * @brief Select how register writes are verified.
+     *
+     * Setters use this policy unless they are given another one per call.
+     * Only the bits in the register's verify_mask are compared.
+     *
+     * @param[in] policy        Verification policy, not GPIO_EXPANDER_VERIFY_DEFAULT.
+     * @param[in] sample_period Verify one write out of sample_period when sampled.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_set_verify_policy(GpioExpanderVerify_t policy, uint16_t sample_period = 1);
+
+    /**
+     * @brief Verify all deferred writes with a single burst read.
+     *
+     * @return ESP_FAIL if any register differs from its last written value.
+     */
+    esp_err_t fxl6408_verify_pending();
+
+    /**
+     * @brief Read the write verification counters.
+     *
+     * @param[out] stats    Counters snapshot.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_read_verify_stats(GpioExpanderVerifyStats_t *stats);
+
+    /**
+     * @brief Drive pins to a level for a fixed time without blocking.
+     *
+     * The pins are set immediately and driven back to the opposite level by
+     * a dedicated task woken by an esp_timer. Edges of overlapping pulses and
+     * toggles that fall within FXL6408_PULSE_MERGE_US of each other share one
+     * OUT_STATE write. The pins must already be configured as non high-Z
+     * outputs.
+     *
+     * @param[in] gpio          FXL6408_GPIO_x mask.
+     * @param[in] level         Pulse level.
+     * @param[in] duration_us   Pulse width in microseconds.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_pulse(uint8_t gpio, uint8_t level, uint32_t duration_us);
+
+    /**
+     * @brief Toggle pins periodically until stopped.
+     *
+     * @param[in] gpio          FXL6408_GPIO_x mask.
+     * @param[in] period_us     Half period (time between edges) in microseconds.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_toggle_start(uint8_t gpio, uint32_t period_us);
+
+    /**
+     * @brief Stop pulses and toggles on pins, leaving their current level.
+     *
+     * @param[in] gpio          FXL6408_GPIO_x mask.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_toggle_stop(uint8_t gpio);
+
+    /**
+     * @brief Enable interrupt storm protection.
+     *
+     * A pin raising more than config->budget interrupts within
+     * config->window_ms is masked in IT_MASK and polled from IN_STATUS every
+     * config->sample_ms instead, still notifying its task on level changes.
+     * It is unmasked once its level was stable for config->calm_ms. Pins of
+     * attached encoders are never throttled.
+     *
+     * @param[in] config    Storm configuration, NULL disables protection.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_set_storm_protection(const GpioExpanderStormConfig_t *config);
+
+    /**
+     * @brief Read how many times a pin was throttled.
+     *
+     * @param[in]  gpio     Expander IO.
+     * @param[out] count    Number of storm events.
+     *
+     * @return
+     */
+    esp_err_t fxl6408_read_storm_count(GpioExpanderEnum_t gpio, uint32_t *count);
+
 private:
+    /*
+     * Scoped hold of the device mutex. It is recursive, so register helpers
+     * can nest inside a locked read-modify-write sequence.
+     */
+    class Lock
+    {
+    public:
+        Lock(SemaphoreHandle_t mutex) : m_mutex(mutex)
+        {
+            if (m_mutex != NULL) xSemaphoreTakeRecursive(m_mutex, portMAX_DELAY);
+        }
+
+        ~Lock()
+        {
+            if (m_mutex != NULL) xSemaphoreGiveRecursive(m_mutex);
+        }
+
+    private:
+        SemaphoreHandle_t m_mutex;
+    };
+
+    /*
+     * Register accessors generated from fxl6408_registers. The templates only
+     * carry the compile-time access checks, all of them share one body.
+     */
+    template <Fxl6408Reg_t R>
+    esp_err_t reg_read(uint8_t *data)
+    {
+        return fxl6408_reg_read(R, data);
+    }
+
+    template <Fxl6408Reg_t R>
+    esp_err_t reg_write(uint8_t data, GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT)
+    {
+        static_assert(fxl6408_registers[R].access == FXL6408_ACCESS_RW, "register is read-only");
+        return fxl6408_reg_write(R, data, verify);
+    }
+
+    template <Fxl6408Reg_t R>
+    esp_err_t reg_update(uint8_t mask, uint8_t value, GpioExpanderVerify_t verify = GPIO_EXPANDER_VERIFY_DEFAULT)
+    {
+        static_assert(fxl6408_registers[R].access == FXL6408_ACCESS_RW, "register is read-only");
+        static_assert(fxl6408_registers[R].cacheable, "read-modify-write needs a stable register");
+        return fxl6408_reg_update(R, mask, value, verify);
+    }
+
+    esp_err_t fxl6408_reg_read(Fxl6408Reg_t reg, uint8_t *data);
+    esp_err_t fxl6408_reg_write(Fxl6408Reg_t reg, uint8_t data, GpioExpanderVerify_t verify);
+    GpioExpanderVerify_t fxl6408_verify_mode(GpioExpanderVerify_t verify);
+    esp_err_t fxl6408_reg_update(Fxl6408Reg_t reg, uint8_t mask, uint8_t value, GpioExpanderVerify_t verify);
+    esp_err_t fxl6408_bus_read(uint8_t reg, uint8_t *data, size_t len);
+    esp_err_t fxl6408_bus_write(uint8_t reg, uint8_t *data, size_t len);
+    void fxl6408_capture(uint8_t reg, uint8_t flags, const uint8_t *data, size_t len,
+                         int64_t start, int64_t end);
+    esp_err_t fxl6408_start_task();
+    esp_err_t fxl6408_update_encoders();
+    esp_err_t fxl6408_pulse_init();
+    void fxl6408_pulse_arm(int64_t now);
+    void fxl6408_pulse_expire();
+    void fxl6408_track_storms(uint8_t status);
+    void fxl6408_sample_throttled();
+    TickType_t fxl6408_storm_wait();
+
     I2C::I2CMaster *m_i2c;
     int m_rst;
     int m_it;
@@ -126,8 +395,45 @@ private:
     uint8_t m_addr_read;
     uint8_t m_addr_write;
     bool m_isInterrupted;
+    uint8_t m_cache[FXL6408_REG_COUNT];
+    uint16_t m_cache_valid;
+    GpioExpanderVerify_t m_verify_policy;
+    uint16_t m_verify_period;
+    uint16_t m_verify_count;
+    uint16_t m_verify_pending;
+    uint8_t m_verify_expected[FXL6408_REG_COUNT];
+    GpioExpanderVerifyStats_t m_verify_stats;
+    SemaphoreHandle_t m_mutex;
+    esp_timer_handle_t m_pulse_timer;
+    std::atomic<TaskHandle_t> m_pulse_task;
+    std::atomic<uint32_t> m_pulse_callbacks;
+    int64_t m_pulse_deadline[8];
+    uint32_t m_pulse_period[8];
+    uint8_t m_pulse_active;
+    uint8_t m_pulse_level;
+    BusScheduler::BusScheduler *m_bus;
+    BusScheduler::BusScheduler *m_bus_client;
+    int m_bus_id;
+    portMUX_TYPE m_capture_lock;
+    uint8_t *m_capture_buffer;
+    size_t m_capture_size;
+    size_t m_capture_length;
+    int64_t m_capture_start;
+    uint32_t m_capture_dropped;
+    Encoder *m_encoders[FXL6408_MAX_ENCODERS];
+    uint8_t m_encoder_count;
+    uint8_t m_encoder_mask;
+    bool m_storm_enabled;
+    GpioExpanderStormConfig_t m_storm;
+    StormTracker m_storm_tracker;
+    TickType_t m_storm_sampled;
+    uint32_t m_storm_count[8];
+    uint8_t m_throttled;
+    uint8_t m_throttled_level;
 
     friend void gpio_expander_task(void *args);
+    friend void gpio_expander_pulse_timer(void *args);
+    friend void gpio_expander_pulse_task(void *args);
     friend esp_err_t gpio_expander_is_gpio_valid(GpioExpanderEnum_t gpio);
 };
 
@@ -0,0 +1,59 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GPIO EXPANDER
+ *
+ * I2C transaction capture stream format. Shared with the host-side replayer
+ * in tools/fxl6408_replay, so it must not depend on ESP-IDF headers.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace GpioExpander
+{
+
+#define FXL6408_CAPTURE_MAGIC               0x434C5846 // "FXLC"
+#define FXL6408_CAPTURE_VERSION             2
+
+#define FXL6408_CAPTURE_FLAG_WRITE          0x01
+#define FXL6408_CAPTURE_FLAG_ERROR          0x02
+#define FXL6408_CAPTURE_FLAG_RESET          0x04 // RST pin pulse, no bus transfer
+
+/*
+ * Stream layout, little endian: one Fxl6408CaptureHeader_t followed by
+ * Fxl6408CaptureRecord_t entries, each immediately followed by len data
+ * bytes (written or read back). Reset markers carry no data.
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t addr;           // 7-bit device address
+    uint16_t reserved;
+    uint32_t dropped;       // records lost because the buffer was full
+} Fxl6408CaptureHeader_t;
+
+typedef struct __attribute__((packed))
+{
+    uint64_t start_us;      // transfer start relative to capture start
+    uint16_t duration_us;   // I2C call duration, saturated at 0xFFFF
+    uint8_t reg;
+    uint8_t flags;
+    uint8_t len;
+} Fxl6408CaptureRecord_t;
+
+} // namespace GpioExpander
@@ -0,0 +1,136 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GpioExpander
+ *
+ * Quadrature encoder decoder class definition.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#include "FXL6408/fxl6408_encoder.hpp"
+
+#include "esp_timer.h"
+
+namespace GpioExpander
+{
+
+#define ENCODER_IDLE_US                     200000
+#define ENCODER_VELOCITY_SHIFT              2
+
+/*
+ * Indexed by (previous AB << 2) | current AB. Valid single-channel steps
+ * yield +1/-1, no change yields 0 and double transitions are marked with
+ * ENCODER_INVALID_STEP.
+ */
+static const int8_t quadrature_table[16] =
+{
+     0, -1,  1,  2,
+     1,  0,  2, -1,
+    -1,  2,  0,  1,
+     2,  1, -1,  0,
+};
+
+static uint8_t encoder_pins(uint8_t input, GpioExpanderEnum_t a, GpioExpanderEnum_t b)
+{
+    return (((input >> a) & 0x01) << 1) | ((input >> b) & 0x01);
+}
+
+Encoder::Encoder(GpioExpanderEnum_t a, GpioExpanderEnum_t b)
+    : m_a(a), m_b(b), m_state(0), m_last_dir(0),
+      m_position(0), m_velocity(0), m_errors(0), m_last_step(0)
+{
+}
+
+int32_t Encoder::position() const
+{
+    return m_position.load(std::memory_order_relaxed);
+}
+
+int32_t Encoder::velocity() const
+{
+    uint32_t now = (uint32_t) esp_timer_get_time();
+
+    if (now - m_last_step.load(std::memory_order_relaxed) > ENCODER_IDLE_US)
+        return 0;
+
+    return m_velocity.load(std::memory_order_relaxed);
+}
+
+uint32_t Encoder::errors() const
+{
+    return m_errors.load(std::memory_order_relaxed);
+}
+
+void Encoder::reset(int32_t position)
+{
+    m_position.store(position, std::memory_order_relaxed);
+}
+
+uint8_t Encoder::mask() const
+{
+    return (1 << m_a) | (1 << m_b);
+}
+
+int8_t Encoder::quadrature_step(uint8_t previous, uint8_t current)
+{
+    return quadrature_table[((previous & 0x03) << 2) | (current & 0x03)];
+}
+
+void Encoder::seed(uint8_t input, uint32_t now)
+{
+    m_state = encoder_pins(input, m_a, m_b);
+    m_last_dir = 0;
+    m_last_step.store(now - ENCODER_IDLE_US - 1, std::memory_order_relaxed);
+}
+
+void Encoder::update(uint8_t input, uint32_t now)
+{
+    uint8_t state = encoder_pins(input, m_a, m_b);
+    int8_t step = quadrature_step(m_state, state);
+
+    m_state = state;
+
+    if (step == 0) return;
+
+    // two edges landed within one service pass, the shaft kept its direction
+    if (step == ENCODER_INVALID_STEP)
+    {
+        if (m_last_dir == 0)
+        {
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        step = 2 * m_last_dir;
+    }
+
+    int8_t dir = step > 0 ? 1 : -1;
+
+    m_position.fetch_add(step, std::memory_order_relaxed);
+
+    uint32_t dt = now - m_last_step.load(std::memory_order_relaxed);
+    int32_t sample = dt > 0 ? (int32_t) (1000000 / dt) * step : 0;
+    int32_t velocity = m_velocity.load(std::memory_order_relaxed);
+
+    if (dir != m_last_dir || dt > ENCODER_IDLE_US)
+        velocity = sample;
+    else
+        velocity += (sample - velocity) >> ENCODER_VELOCITY_SHIFT;
+
+    m_last_dir = dir;
+    m_velocity.store(velocity, std::memory_order_relaxed);
+    m_last_step.store(now, std::memory_order_relaxed);
+}
+
+} // namespace GpioExpander
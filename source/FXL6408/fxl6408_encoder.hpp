@@ -0,0 +1,111 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GPIO EXPANDER
+ *
+ * Quadrature encoder decoder class declaration.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+
+#include "FXL6408/fxl6408.hpp"
+
+namespace GpioExpander
+{
+
+#define ENCODER_INVALID_STEP 2
+
+/**
+ * @brief Quadrature encoder attached to two expander inputs.
+ *
+ * The pin pair is sampled from IN_STATUS by the expander interrupt task and
+ * decoded with a transition table. Position, velocity and error count are
+ * kept in atomics so any task can query them without touching the bus.
+ */
+
+class Encoder
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] a     Expander IO connected to encoder channel A.
+     * @param[in] b     Expander IO connected to encoder channel B.
+     */
+    Encoder(GpioExpanderEnum_t a, GpioExpanderEnum_t b);
+
+    /**
+     * @brief Signed position in quadrature counts (four per detent cycle).
+     */
+    int32_t position() const;
+
+    /**
+     * @brief Velocity estimate in counts per second, zero once idle.
+     */
+    int32_t velocity() const;
+
+    /**
+     * @brief Number of invalid transitions (both channels changed at once
+     *        before a direction was known).
+     *
+     * Once a direction is known, a double transition is taken as two steps
+     * in that direction, so edges closer than one service pass still count.
+     */
+    uint32_t errors() const;
+
+    /**
+     * @brief Overwrite the position counter.
+     *
+     * @param[in] position  New position value.
+     */
+    void reset(int32_t position = 0);
+
+    /**
+     * @brief Expander bit mask of both encoder pins.
+     */
+    uint8_t mask() const;
+
+    /**
+     * @brief Decode one transition of the AB pair.
+     *
+     * @param[in] previous  Previous AB state (A in bit 1, B in bit 0).
+     * @param[in] current   Current AB state.
+     *
+     * @return +1/-1 for a step, 0 for no change, ENCODER_INVALID_STEP when
+     *         both channels changed.
+     */
+    static int8_t quadrature_step(uint8_t previous, uint8_t current);
+
+private:
+    void seed(uint8_t input, uint32_t now);
+    void update(uint8_t input, uint32_t now);
+
+    GpioExpanderEnum_t m_a;
+    GpioExpanderEnum_t m_b;
+    uint8_t m_state;
+    int8_t m_last_dir;
+
+    std::atomic<int32_t> m_position;
+    std::atomic<int32_t> m_velocity;
+    std::atomic<uint32_t> m_errors;
+    std::atomic<uint32_t> m_last_step;
+
+    friend class GpioExpander;
+    friend void gpio_expander_task(void *args);
+};
+
+} // namespace GpioExpander
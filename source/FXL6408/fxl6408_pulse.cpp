@@ -0,0 +1,245 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GpioExpander
+ *
+ * GpioExpander timed output (pulse and toggle) definitions.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#include "FXL6408/fxl6408.hpp"
+
+namespace GpioExpander
+{
+
+/*
+ * Runs in the shared esp_timer task, which must never block on the device
+ * lock or the bus. The OUT_STATE write is left to the pulse task.
+ *
+ * esp_timer_delete() does not wait for a callback already running, so the
+ * callback announces itself in m_pulse_callbacks before loading the task
+ * handle. deinit() clears the handle and then waits for the count to drain,
+ * so the task it lets exit is never notified afterwards.
+ */
+void gpio_expander_pulse_timer(void *args)
+{
+    GpioExpander *expander = static_cast<GpioExpander *>(args);
+
+    expander->m_pulse_callbacks.fetch_add(1);
+
+    TaskHandle_t task = expander->m_pulse_task.load();
+    if (task != NULL) xTaskNotifyGive(task);
+
+    expander->m_pulse_callbacks.fetch_sub(1);
+}
+
+// Exits on its own once deinit() unregistered it.
+void gpio_expander_pulse_task(void *args)
+{
+    GpioExpander *expander = static_cast<GpioExpander *>(args);
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (expander->m_pulse_task.load() != self) break;
+
+        expander->fxl6408_pulse_expire();
+    }
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t GpioExpander::fxl6408_pulse_init()
+{
+    Lock lock(m_mutex);
+
+    if (m_pulse_timer != NULL) return ESP_OK;
+
+    if (m_pulse_task.load() == NULL)
+    {
+        TaskHandle_t task = NULL;
+
+        auto ok = xTaskCreate(gpio_expander_pulse_task, "gpio_expander_pulse", 2048,
+                              static_cast<void *>(this), FXL6408_PULSE_TASK_PRIORITY, &task);
+        if (pdPASS != ok) return ESP_ERR_NO_MEM;
+
+        // the task only checks its registration after a notification
+        m_pulse_task.store(task);
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = gpio_expander_pulse_timer;
+    args.arg = static_cast<void *>(this);
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "gpio_expander_pulse";
+
+    return esp_timer_create(&args, &m_pulse_timer);
+}
+
+/*
+ * Must be called with the device lock held. Re-arms the one-shot timer for the
+ * earliest pending edge.
+ */
+void GpioExpander::fxl6408_pulse_arm(int64_t now)
+{
+    if (m_pulse_timer == NULL) return;
+
+    esp_timer_stop(m_pulse_timer);
+
+    if (m_pulse_active == 0) return;
+
+    int64_t earliest = INT64_MAX;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+        if ((m_pulse_active & (1 << idx)) != 0 && m_pulse_deadline[idx] < earliest)
+            earliest = m_pulse_deadline[idx];
+
+    esp_timer_start_once(m_pulse_timer, earliest > now ? earliest - now : 1);
+}
+
+/*
+ * Runs in the pulse task. Every edge due within the merge window goes out in
+ * a single OUT_STATE write, so jitter is bounded by bus time.
+ */
+void GpioExpander::fxl6408_pulse_expire()
+{
+    Lock lock(m_mutex);
+
+    // a notification may still be pending after deinit() deleted the timer
+    if (m_pulse_timer == NULL) return;
+
+    int64_t now = esp_timer_get_time();
+    uint8_t mask = 0;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+    {
+        uint8_t bit = 1 << idx;
+
+        if ((m_pulse_active & bit) == 0 || m_pulse_deadline[idx] > now + FXL6408_PULSE_MERGE_US)
+            continue;
+
+        mask |= bit;
+
+        if (m_pulse_period[idx] == 0)
+        {
+            m_pulse_active &= ~bit;
+            continue;
+        }
+
+        m_pulse_deadline[idx] += m_pulse_period[idx];
+        if (m_pulse_deadline[idx] <= now) m_pulse_deadline[idx] = now + m_pulse_period[idx];
+    }
+
+    uint8_t level = m_pulse_level;
+
+    // toggling pins alternate, one-shot pins keep their restore level
+    for (uint8_t idx = 0; idx <= 7; idx++)
+        if ((mask & (1 << idx)) != 0 && m_pulse_period[idx] != 0)
+            m_pulse_level ^= 1 << idx;
+
+    if (mask != 0) reg_update<FXL6408_REG_OUT_STATE>(mask, level, GPIO_EXPANDER_VERIFY_NONE);
+
+    fxl6408_pulse_arm(esp_timer_get_time());
+}
+
+esp_err_t GpioExpander::fxl6408_pulse(uint8_t gpio, uint8_t level, uint32_t duration_us)
+{
+    if (gpio == 0 || duration_us == 0) return ESP_ERR_INVALID_ARG;
+
+    esp_err_t err = fxl6408_pulse_init();
+    if (err != ESP_OK) return err;
+
+    Lock lock(m_mutex);
+
+    err = reg_update<FXL6408_REG_OUT_STATE>(gpio, level ? 0xFF : 0x00, GPIO_EXPANDER_VERIFY_NONE);
+
+    if (err == ESP_OK)
+    {
+        int64_t now = esp_timer_get_time();
+
+        for (uint8_t idx = 0; idx <= 7; idx++)
+        {
+            if ((gpio & (1 << idx)) == 0) continue;
+
+            m_pulse_deadline[idx] = now + duration_us;
+            m_pulse_period[idx] = 0;
+        }
+
+        m_pulse_active |= gpio;
+        m_pulse_level = (m_pulse_level & ~gpio) | ((level ? 0x00 : 0xFF) & gpio);
+
+        fxl6408_pulse_arm(now);
+    }
+
+    return err;
+}
+
+esp_err_t GpioExpander::fxl6408_toggle_start(uint8_t gpio, uint32_t period_us)
+{
+    if (gpio == 0 || period_us == 0) return ESP_ERR_INVALID_ARG;
+
+    esp_err_t err = fxl6408_pulse_init();
+    if (err != ESP_OK) return err;
+
+    Lock lock(m_mutex);
+
+    uint8_t output = 0;
+
+    err = reg_read<FXL6408_REG_OUT_STATE>(&output);
+
+    if (err == ESP_OK)
+    {
+        int64_t now = esp_timer_get_time();
+
+        for (uint8_t idx = 0; idx <= 7; idx++)
+        {
+            if ((gpio & (1 << idx)) == 0) continue;
+
+            m_pulse_deadline[idx] = now + period_us;
+            m_pulse_period[idx] = period_us;
+        }
+
+        m_pulse_active |= gpio;
+        m_pulse_level = (m_pulse_level & ~gpio) | (~output & gpio);
+
+        fxl6408_pulse_arm(now);
+    }
+
+    return err;
+}
+
+esp_err_t GpioExpander::fxl6408_toggle_stop(uint8_t gpio)
+{
+    Lock lock(m_mutex);
+
+    if (m_pulse_timer == NULL) return ESP_OK;
+
+    m_pulse_active &= ~gpio;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+    {
+        if ((gpio & (1 << idx)) == 0) continue;
+
+        m_pulse_deadline[idx] = 0;
+        m_pulse_period[idx] = 0;
+    }
+
+    fxl6408_pulse_arm(esp_timer_get_time());
+
+    return ESP_OK;
+}
+
+} // namespace GpioExpander
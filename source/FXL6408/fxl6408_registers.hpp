@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GPIO EXPANDER
+ *
+ * FXL6408 register map.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace GpioExpander
+{
+
+#define FXL6408_ADDRESS_UID_CTRL            0x01 // R/W
+#define FXL6408_ADDRESS_IO_DIR              0x03 // R/W
+#define FXL6408_ADDRESS_OUT_STATE           0x05 // R/W
+#define FXL6408_ADDRESS_OUT_HIGHZ           0x07 // R/W
+#define FXL6408_ADDRESS_IN_DEFAULT_STATE    0x09 // R/W
+#define FXL6408_ADDRESS_PU_EN               0x0B // R/W
+#define FXL6408_ADDRESS_PU_PD               0x0D // R/W
+#define FXL6408_ADDRESS_IN_STATUS           0x0F // R
+#define FXL6408_ADDRESS_IT_MASK             0x11 // R/W
+#define FXL6408_ADDRESS_IT_STATUS           0x13 // R, clears on read
+
+#define FXL6408_ADDRESS_RESERVED_1          0x02
+#define FXL6408_ADDRESS_RESERVED_2          0x04
+#define FXL6408_ADDRESS_RESERVED_3          0x06
+#define FXL6408_ADDRESS_RESERVED_4          0x08
+#define FXL6408_ADDRESS_RESERVED_5          0x0A
+#define FXL6408_ADDRESS_RESERVED_6          0x0C
+#define FXL6408_ADDRESS_RESERVED_7          0x0E
+#define FXL6408_ADDRESS_RESERVED_8          0x10
+#define FXL6408_ADDRESS_RESERVED_9          0x12
+
+#define FXL6408_UID_CTRL_SW_RST             0x01
+
+typedef enum : uint8_t
+{
+    FXL6408_REG_UID_CTRL = 0,
+    FXL6408_REG_IO_DIR,
+    FXL6408_REG_OUT_STATE,
+    FXL6408_REG_OUT_HIGHZ,
+    FXL6408_REG_IN_DEFAULT_STATE,
+    FXL6408_REG_PU_EN,
+    FXL6408_REG_PU_PD,
+    FXL6408_REG_IN_STATUS,
+    FXL6408_REG_IT_MASK,
+    FXL6408_REG_IT_STATUS,
+    FXL6408_REG_COUNT,
+} Fxl6408Reg_t;
+
+typedef enum : uint8_t
+{
+    FXL6408_ACCESS_R = 0,
+    FXL6408_ACCESS_RW = 1,
+} Fxl6408Access_t;
+
+typedef struct
+{
+    uint8_t addr;
+    Fxl6408Access_t access;
+    uint8_t reset;          // power-on value
+    bool is_volatile;       // changed by the device itself
+    bool cacheable;         // safe to serve read-modify-write from a shadow copy
+    uint8_t verify_mask;    // bits that must read back as written
+    const char *name;
+} Fxl6408Register_t;
+
+/*
+ * Indexed by Fxl6408Reg_t. UID_CTRL holds read-only ID bits and
+ * self-clearing reset bits, IN_STATUS follows the pins and IT_STATUS clears
+ * on read, so none of them may be cached or verified.
+ */
+static constexpr Fxl6408Register_t fxl6408_registers[FXL6408_REG_COUNT] =
+{
+    { FXL6408_ADDRESS_UID_CTRL,         FXL6408_ACCESS_RW, 0xA2, true,  false, 0x00, "ctrl"     },
+    { FXL6408_ADDRESS_IO_DIR,           FXL6408_ACCESS_RW, 0x00, false, true,  0xFF, "dir"      },
+    { FXL6408_ADDRESS_OUT_STATE,        FXL6408_ACCESS_RW, 0x00, false, true,  0xFF, "output"   },
+    { FXL6408_ADDRESS_OUT_HIGHZ,        FXL6408_ACCESS_RW, 0xFF, false, true,  0xFF, "highz"    },
+    { FXL6408_ADDRESS_IN_DEFAULT_STATE, FXL6408_ACCESS_RW, 0x00, false, true,  0xFF, "input"    },
+    { FXL6408_ADDRESS_PU_EN,            FXL6408_ACCESS_RW, 0xFF, false, true,  0xFF, "pu_en"    },
+    { FXL6408_ADDRESS_PU_PD,            FXL6408_ACCESS_RW, 0x00, false, true,  0xFF, "pu_pd"    },
+    { FXL6408_ADDRESS_IN_STATUS,        FXL6408_ACCESS_R,  0x00, true,  false, 0x00, "status"   },
+    { FXL6408_ADDRESS_IT_MASK,          FXL6408_ACCESS_RW, 0xFF, false, true,  0xFF, "mask"     },
+    { FXL6408_ADDRESS_IT_STATUS,        FXL6408_ACCESS_R,  0x00, true,  false, 0x00, "it_status"},
+};
+
+constexpr bool fxl6408_registers_ordered()
+{
+    for (int idx = 1; idx < FXL6408_REG_COUNT; idx++)
+        if (fxl6408_registers[idx].addr <= fxl6408_registers[idx - 1].addr) return false;
+
+    return true;
+}
+
+static_assert(fxl6408_registers_ordered(), "register table must be sorted by address");
+
+} // namespace GpioExpander
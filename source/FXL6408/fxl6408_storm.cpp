@@ -0,0 +1,89 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GpioExpander
+ *
+ * Interrupt storm rate tracker class definition.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#include "FXL6408/fxl6408_storm.hpp"
+
+namespace GpioExpander
+{
+
+StormTracker::StormTracker()
+    : m_budget(0), m_window(0), m_calm(0), m_window_start(0)
+{
+    for (uint8_t idx = 0; idx <= 7; idx++)
+    {
+        m_calm_start[idx] = 0;
+        m_count[idx] = 0;
+    }
+}
+
+void StormTracker::configure(uint16_t budget, TickType_t window, TickType_t calm, TickType_t now)
+{
+    m_budget = budget;
+    m_window = window;
+    m_calm = calm;
+    m_window_start = now;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+        m_count[idx] = 0;
+}
+
+uint8_t StormTracker::count(uint8_t status, uint8_t exempt, TickType_t now)
+{
+    if (now - m_window_start >= m_window)
+    {
+        m_window_start = now;
+
+        for (uint8_t idx = 0; idx <= 7; idx++)
+            m_count[idx] = 0;
+    }
+
+    uint8_t over = 0;
+
+    status &= ~exempt;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+    {
+        if ((status & (1 << idx)) == 0) continue;
+        if (++m_count[idx] <= m_budget) continue;
+
+        m_count[idx] = 0;
+        over |= 1 << idx;
+    }
+
+    return over;
+}
+
+void StormTracker::touch(uint8_t pins, TickType_t now)
+{
+    for (uint8_t idx = 0; idx <= 7; idx++)
+        if ((pins & (1 << idx)) != 0) m_calm_start[idx] = now;
+}
+
+uint8_t StormTracker::calmed(uint8_t pins, TickType_t now) const
+{
+    uint8_t calm = 0;
+
+    for (uint8_t idx = 0; idx <= 7; idx++)
+        if ((pins & (1 << idx)) != 0 && now - m_calm_start[idx] >= m_calm) calm |= 1 << idx;
+
+    return calm;
+}
+
+} // namespace GpioExpander
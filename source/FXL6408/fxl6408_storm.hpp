@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GPIO EXPANDER
+ *
+ * Interrupt storm rate tracker class declaration.
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+namespace GpioExpander
+{
+
+/**
+ * @brief Per-pin interrupt rate and calm time bookkeeping.
+ *
+ * Pure tick arithmetic, no bus access: the expander feeds it IT_STATUS and
+ * level changes and applies the returned masks to IT_MASK itself.
+ */
+
+class StormTracker
+{
+public:
+    /**
+     * @brief Constructor.
+     */
+    StormTracker();
+
+    /**
+     * @brief Set the limits and restart the rate window.
+     *
+     * @param[in] budget    Interrupts allowed per pin and window.
+     * @param[in] window    Rate measurement window in ticks.
+     * @param[in] calm      Stable time in ticks required before unmasking.
+     * @param[in] now       Current tick count.
+     */
+    void configure(uint16_t budget, TickType_t window, TickType_t calm, TickType_t now);
+
+    /**
+     * @brief Count one interrupt pass.
+     *
+     * @param[in] status    Pins that raised an interrupt.
+     * @param[in] exempt    Pins not to count (already masked, encoders).
+     * @param[in] now       Current tick count.
+     *
+     * @return Pins that exceeded the budget within the current window.
+     */
+    uint8_t count(uint8_t status, uint8_t exempt, TickType_t now);
+
+    /**
+     * @brief Restart the calm time of pins (masked, or their level changed).
+     *
+     * @param[in] pins  Pin mask.
+     * @param[in] now   Current tick count.
+     */
+    void touch(uint8_t pins, TickType_t now);
+
+    /**
+     * @brief Pins whose level was stable for the calm time.
+     *
+     * @param[in] pins  Candidate pin mask, usually the masked pins.
+     * @param[in] now   Current tick count.
+     */
+    uint8_t calmed(uint8_t pins, TickType_t now) const;
+
+private:
+    uint16_t m_budget;
+    TickType_t m_window;
+    TickType_t m_calm;
+    TickType_t m_window_start;
+    TickType_t m_calm_start[8];
+    uint16_t m_count[8];
+};
+
+} // namespace GpioExpander
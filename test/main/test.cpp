@@ -3,6 +3,9 @@
 #include "esp_log.h"
 
 #include "FXL6408/fxl6408.hpp"
+#include "FXL6408/fxl6408_encoder.hpp"
+#include "FXL6408/fxl6408_storm.hpp"
+#include "BusScheduler/bus_scheduler.hpp"
 #include "freertos/task.h"
 
 static const char* TAG = "test.cpp";
@@ -19,6 +22,12 @@ TaskHandle_t status_thread = nullptr;
 
 void fxl6408_test_communication(GpioExpander::GpioExpander *test);
 void fxl6408_test_reset(GpioExpander::GpioExpander *test);
+void fxl6408_test_quadrature();
+void fxl6408_test_encoder(GpioExpander::GpioExpander *test);
+void fxl6408_test_storm();
+void fxl6408_test_scheduler();
+void fxl6408_test_pulse(GpioExpander::GpioExpander *test);
+void fxl6408_test_verify(GpioExpander::GpioExpander *test);
 
 void fxl6408_test_communication(GpioExpander::GpioExpander *test)
 {
@@ -58,6 +67,292 @@ void fxl6408_test_reset(GpioExpander::GpioExpander *test)
     }
 }
 
+void fxl6408_test_quadrature()
+{
+    printf("\r\n**********[FXL6408] QUADRATURE TEST BEGIN**********\r\n");
+
+    // one full cycle in each direction, A in bit 1 and B in bit 0
+    const uint8_t cycle[] = { 0x00, 0x01, 0x03, 0x02, 0x00 };
+    int32_t forward = 0;
+    int32_t backward = 0;
+    bool ok = true;
+
+    for (uint8_t idx = 0; idx < 4; idx++)
+    {
+        forward += GpioExpander::Encoder::quadrature_step(cycle[idx], cycle[idx + 1]);
+        backward += GpioExpander::Encoder::quadrature_step(cycle[idx + 1], cycle[idx]);
+    }
+
+    if (forward != -4 || backward != 4) ok = false;
+
+    for (uint8_t state = 0; state < 4; state++)
+    {
+        if (GpioExpander::Encoder::quadrature_step(state, state) != 0) ok = false;
+        if (GpioExpander::Encoder::quadrature_step(state, state ^ 0x03) != ENCODER_INVALID_STEP) ok = false;
+    }
+
+    if (!ok)
+        printf("\r\n**********[FXL6408] QUADRATURE TEST FAIL**********\r\n");
+    else
+        printf("\r\n**********[FXL6408] QUADRATURE TEST OK**********\r\n");
+    printf("forward = %ld backward = %ld\r\n", (long) forward, (long) backward);
+}
+
+void fxl6408_test_encoder(GpioExpander::GpioExpander *test)
+{
+    printf("\r\n**********[FXL6408] ENCODER TEST BEGIN**********\r\n");
+
+    static GpioExpander::Encoder encoder(GpioExpander::GPIO_EXPANDER_IO_2, GpioExpander::GPIO_EXPANDER_IO_3);
+
+    esp_err_t err = test->fxl6408_attach_encoder(&encoder);
+    if (err != ESP_OK)
+    {
+        printf("\r\n**********[FXL6408] ENCODER TEST FAIL**********\r\n");
+        return;
+    }
+
+    printf("turn the encoder on IO_2/IO_3\r\n");
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+
+    if (encoder.position() == 0 || encoder.errors() != 0)
+        printf("\r\n**********[FXL6408] ENCODER TEST FAIL**********\r\n");
+    else
+        printf("\r\n**********[FXL6408] ENCODER TEST OK**********\r\n");
+    printf("position = %ld velocity = %ld errors = %lu\r\n", (long) encoder.position(),
+           (long) encoder.velocity(), (unsigned long) encoder.errors());
+}
+
+void fxl6408_test_storm()
+{
+    printf("\r\n**********[FXL6408] STORM TEST BEGIN**********\r\n");
+
+    GpioExpander::StormTracker tracker;
+    bool ok = true;
+
+    // budget of 3 per 10 ticks, 20 ticks of calm before unmasking
+    tracker.configure(3, 10, 20, 0);
+
+    for (TickType_t now = 1; now <= 3; now++)
+        if (tracker.count(0x01, 0x00, now) != 0) ok = false;
+    if (tracker.count(0x01, 0x00, 4) != 0x01) ok = false;
+
+    // the window rolls over before the budget is used up
+    tracker.configure(3, 10, 20, 0);
+
+    for (TickType_t now = 1; now <= 3; now++)
+        tracker.count(0x02, 0x00, now);
+    if (tracker.count(0x02, 0x00, 12) != 0) ok = false;
+
+    // exempt pins (masked or encoders) are never counted
+    for (TickType_t now = 13; now <= 18; now++)
+        if (tracker.count(0x04, 0x04, now) != 0) ok = false;
+
+    // a level change restarts the calm time
+    tracker.touch(0x01, 100);
+    if (tracker.calmed(0x01, 110) != 0) ok = false;
+    tracker.touch(0x01, 115);
+    if (tracker.calmed(0x01, 120) != 0) ok = false;
+    if (tracker.calmed(0x01, 135) != 0x01) ok = false;
+
+    if (!ok)
+        printf("\r\n**********[FXL6408] STORM TEST FAIL**********\r\n");
+    else
+        printf("\r\n**********[FXL6408] STORM TEST OK**********\r\n");
+}
+
+void fxl6408_test_pulse(GpioExpander::GpioExpander *test)
+{
+    printf("\r\n**********[FXL6408] PULSE TEST BEGIN**********\r\n");
+
+    esp_err_t err = ESP_OK;
+    uint8_t during = 0;
+    uint8_t after = 0;
+
+    test->fxl6408_set_io_dir(FXL6408_GPIO_7, FXL6408_GPIO_MODE_OUTPUT);
+    test->fxl6408_set_io_highz(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_NO_HIGHZ);
+    test->fxl6408_set_io_level(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_LOW);
+
+    err = test->fxl6408_pulse(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_HIGH, 20000);
+    if (err == ESP_OK) err = test->fxl6408_read_io_level(&during);
+
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+
+    if (err == ESP_OK) err = test->fxl6408_read_io_level(&after);
+
+    if (err != ESP_OK || (during & FXL6408_GPIO_7) == 0 || (after & FXL6408_GPIO_7) != 0)
+    {
+        printf("\r\n**********[FXL6408] PULSE TEST FAIL**********\r\n");
+        printf("during = 0x%02x after = 0x%02x\r\n", during, after);
+        return;
+    }
+
+    err = test->fxl6408_toggle_start(FXL6408_GPIO_7, 10000);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+    if (err == ESP_OK) err = test->fxl6408_toggle_stop(FXL6408_GPIO_7);
+
+    if (err != ESP_OK)
+        printf("\r\n**********[FXL6408] PULSE TEST FAIL**********\r\n");
+    else
+        printf("\r\n**********[FXL6408] PULSE TEST OK**********\r\n");
+}
+
+void fxl6408_test_verify(GpioExpander::GpioExpander *test)
+{
+    printf("\r\n**********[FXL6408] VERIFY TEST BEGIN**********\r\n");
+
+    GpioExpander::GpioExpanderVerifyStats_t before = {};
+    GpioExpander::GpioExpanderVerifyStats_t after = {};
+
+    esp_err_t err = test->fxl6408_set_io_dir(FXL6408_GPIO_7, FXL6408_GPIO_MODE_OUTPUT);
+    if (err == ESP_OK) err = test->fxl6408_set_io_level(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_LOW);
+    if (err == ESP_OK) err = test->fxl6408_read_verify_stats(&before);
+
+    if (err == ESP_OK) err = test->fxl6408_set_verify_policy(GpioExpander::GPIO_EXPANDER_VERIFY_DEFERRED);
+    if (err == ESP_OK) err = test->fxl6408_set_io_level(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_HIGH);
+
+    // an unverified write to a pending register must move the expected value
+    if (err == ESP_OK)
+        err = test->fxl6408_set_io_level(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_LOW,
+                                         GpioExpander::GPIO_EXPANDER_VERIFY_NONE);
+    if (err == ESP_OK) err = test->fxl6408_verify_pending();
+    if (err == ESP_OK) err = test->fxl6408_read_verify_stats(&after);
+
+    // under ALWAYS an update the cache says is a no-op is still read back
+    GpioExpander::GpioExpanderVerifyStats_t unchanged = {};
+
+    if (err == ESP_OK) err = test->fxl6408_set_verify_policy(GpioExpander::GPIO_EXPANDER_VERIFY_ALWAYS);
+    if (err == ESP_OK) err = test->fxl6408_set_io_level(FXL6408_GPIO_7, FXL6408_GPIO_LEVEL_LOW);
+    if (err == ESP_OK) err = test->fxl6408_read_verify_stats(&unchanged);
+
+    test->fxl6408_set_verify_policy(GpioExpander::GPIO_EXPANDER_VERIFY_ALWAYS);
+
+    if (err != ESP_OK || after.deferred == before.deferred || after.mismatches != before.mismatches ||
+        unchanged.verified == after.verified || unchanged.writes != after.writes)
+        printf("\r\n**********[FXL6408] VERIFY TEST FAIL**********\r\n");
+    else
+        printf("\r\n**********[FXL6408] VERIFY TEST OK**********\r\n");
+
+    printf("writes = %lu deferred = %lu verified = %lu mismatches = %lu\r\n",
+           (unsigned long) after.writes, (unsigned long) after.deferred,
+           (unsigned long) after.verified, (unsigned long) after.mismatches);
+}
+
+typedef struct
+{
+    BusScheduler::BusScheduler *bus;
+    int id;
+    BusScheduler::BusPriority_t priority;
+} SchedulerTestClient_t;
+
+static int scheduler_order[2];
+static volatile int scheduler_granted = 0;
+
+void scheduler_test_client(void *arg)
+{
+    SchedulerTestClient_t *client = static_cast<SchedulerTestClient_t *>(arg);
+
+    client->bus->acquire(client->id, client->priority);
+    scheduler_order[scheduler_granted++] = client->id;
+    client->bus->release(client->id);
+
+    vTaskDelete(NULL);
+}
+
+/*
+ * Inheritance case: the holder owns a mutex a priority 5 task waits on, so it
+ * calls acquire() at an inherited priority. A priority 8 bus waiter then
+ * boosts it. Once the bus and the mutex are released the holder must be back
+ * at its own priority 2, not at the inherited 5.
+ */
+static SemaphoreHandle_t scheduler_mutex = NULL;
+static volatile bool scheduler_holder_ready = false;
+static volatile bool scheduler_waiters_ready = false;
+static volatile UBaseType_t scheduler_holder_priority = 0;
+
+void scheduler_test_holder(void *arg)
+{
+    SchedulerTestClient_t *client = static_cast<SchedulerTestClient_t *>(arg);
+
+    xSemaphoreTake(scheduler_mutex, portMAX_DELAY);
+    client->bus->acquire(client->id, client->priority);
+    scheduler_holder_ready = true;
+
+    while (!scheduler_waiters_ready) vTaskDelay(1);
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+
+    client->bus->release(client->id);
+    xSemaphoreGive(scheduler_mutex);
+
+    scheduler_holder_priority = uxTaskPriorityGet(NULL);
+
+    vTaskDelete(NULL);
+}
+
+void scheduler_test_mutex_waiter(void *arg)
+{
+    xSemaphoreTake(scheduler_mutex, portMAX_DELAY);
+    xSemaphoreGive(scheduler_mutex);
+
+    vTaskDelete(NULL);
+}
+
+void fxl6408_test_scheduler()
+{
+    printf("\r\n**********[FXL6408] SCHEDULER TEST BEGIN**********\r\n");
+
+    static BusScheduler::BusScheduler bus;
+    static SchedulerTestClient_t bulk = { &bus, 0, BusScheduler::BUS_PRIORITY_BULK };
+    static SchedulerTestClient_t urgent = { &bus, 0, BusScheduler::BUS_PRIORITY_URGENT };
+    int owner = 0;
+
+    if (bus.add_client("owner", &owner) != ESP_OK ||
+        bus.add_client("bulk", &bulk.id) != ESP_OK ||
+        bus.add_client("urgent", &urgent.id) != ESP_OK)
+    {
+        printf("\r\n**********[FXL6408] SCHEDULER TEST FAIL**********\r\n");
+        return;
+    }
+
+    // the bulk client queues first, the urgent one must still be served first
+    bus.acquire(owner, BusScheduler::BUS_PRIORITY_BULK);
+    xTaskCreate(scheduler_test_client, "bus_bulk", 2048, &bulk, 5, NULL);
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+    xTaskCreate(scheduler_test_client, "bus_urgent", 2048, &urgent, 5, NULL);
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+
+    bool yield = bus.should_yield(owner);
+    bus.release(owner);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+
+    BusScheduler::BusClientStats_t stats = {};
+    bus.read_stats(bulk.id, &stats);
+
+    bool ordered = yield && scheduler_granted == 2 && scheduler_order[0] == urgent.id &&
+                   scheduler_order[1] == bulk.id;
+
+    static SchedulerTestClient_t holder = { &bus, owner, BusScheduler::BUS_PRIORITY_NORMAL };
+    static SchedulerTestClient_t waiter = { &bus, urgent.id, BusScheduler::BUS_PRIORITY_URGENT };
+
+    scheduler_mutex = xSemaphoreCreateMutex();
+    scheduler_granted = 0;
+
+    xTaskCreate(scheduler_test_holder, "bus_holder", 2048, &holder, 2, NULL);
+    while (!scheduler_holder_ready) vTaskDelay(1);
+    xTaskCreate(scheduler_test_mutex_waiter, "bus_mutex", 2048, NULL, 5, NULL);
+    xTaskCreate(scheduler_test_client, "bus_waiter", 2048, &waiter, 8, NULL);
+    scheduler_waiters_ready = true;
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+
+    vSemaphoreDelete(scheduler_mutex);
+
+    if (!ordered || scheduler_granted != 1 || scheduler_holder_priority != 2)
+        printf("\r\n**********[FXL6408] SCHEDULER TEST FAIL**********\r\n");
+    else
+        printf("\r\n**********[FXL6408] SCHEDULER TEST OK**********\r\n");
+    printf("bulk waited %lu us, holder restored to priority %lu\r\n", (unsigned long) stats.wait_max_us,
+           (unsigned long) scheduler_holder_priority);
+}
+
 // STM66_GPIO5 INT
 // STM66_GPIO6 PS_HOLD
 
@@ -91,6 +386,12 @@ extern "C" void app_main(void)
 
     fxl6408_test_communication(dev);
     fxl6408_test_reset(dev);
+    fxl6408_test_quadrature();
+    fxl6408_test_storm();
+    fxl6408_test_scheduler();
+    fxl6408_test_encoder(dev);
+    fxl6408_test_pulse(dev);
+    fxl6408_test_verify(dev);
     
     dev->fxl6408_set_io_dir(FXL6408_GPIO_5, FXL6408_GPIO_MODE_INPUT);
     dev->fxl6408_set_it_mask(FXL6408_GPIO_5, FXL6408_GPIO_NO_MASK);
@@ -0,0 +1,468 @@
+/******************************************************************************
+ * Copyright © 2008 - 2024, F&K Group. All rights reserved.
+ *
+ * No part of this software may be reproduced, distributed, or transmitted in
+ * any form or by any means without the prior written permission of the F&K Group
+ * company.
+ *
+ * For permission requests, contact the company through the e-mail address
+ * tbd@fkgroup.com.br with subject "Software Licence Request".
+ ******************************************************************************/
+
+/*******************************************************************************
+ * F&K Group FXL6408 GPIO EXPANDER
+ *
+ * Host-side capture replayer. Replays captures produced by
+ * GpioExpander::fxl6408_capture_start() against a simulated FXL6408 and
+ * reports transaction counts and bus time. With two captures of the same
+ * scenario, it reports the deltas between driver versions. -t replays
+ * built-in synthetic captures against their expected results.
+ *
+ * Build: g++ -std=c++17 -O2 -o fxl6408_replay fxl6408_replay.cpp
+ * Usage: fxl6408_replay [-c clock_hz] baseline.bin [candidate.bin]
+ *        fxl6408_replay -t
+ *
+ * @author Leonardo Hirata
+ * @copyright F&K Group
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "../../source/FXL6408/fxl6408_capture.hpp"
+#include "../../source/FXL6408/fxl6408_registers.hpp"
+
+using namespace GpioExpander;
+
+#define REPLAY_DEFAULT_CLOCK_HZ             400000
+#define REPLAY_ADDRESS_SPACE                0x20
+
+typedef struct
+{
+    const char *path;
+    uint32_t transactions;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t errors;
+    uint32_t resets;
+    uint32_t dropped;
+    uint32_t mismatches;
+    uint32_t illegal;
+    uint64_t measured_us;
+    uint64_t modeled_us;
+    uint64_t span_us;
+    uint32_t reg_reads[REPLAY_ADDRESS_SPACE];
+    uint32_t reg_writes[REPLAY_ADDRESS_SPACE];
+} ReplayReport_t;
+
+static const Fxl6408Register_t *find_register(uint8_t addr)
+{
+    for (int idx = 0; idx < FXL6408_REG_COUNT; idx++)
+        if (fxl6408_registers[idx].addr == addr) return &fxl6408_registers[idx];
+
+    return NULL;
+}
+
+/**
+ * @brief Register-level FXL6408 model.
+ *
+ * Volatile registers follow external pins, so their captured values are
+ * taken as the truth. Captures usually start mid-session, so a stable
+ * register is unknown until it is first read or written; its first read
+ * seeds the model. Every later read must match the modelled state.
+ */
+
+class SimulatedFxl6408
+{
+public:
+    SimulatedFxl6408()
+    {
+        memset(m_regs, 0, sizeof(m_regs));
+        m_known = 0;
+    }
+
+    void reset()
+    {
+        for (int idx = 0; idx < FXL6408_REG_COUNT; idx++)
+            m_regs[fxl6408_registers[idx].addr] = fxl6408_registers[idx].reset;
+
+        m_known = 0xFFFFFFFF;
+    }
+
+    // Returns false when the write targets a read-only or reserved address.
+    bool write(uint8_t addr, uint8_t data)
+    {
+        const Fxl6408Register_t *desc = find_register(addr);
+        if (desc == NULL || desc->access != FXL6408_ACCESS_RW) return false;
+
+        if (addr == FXL6408_ADDRESS_UID_CTRL)
+        {
+            if (data & FXL6408_UID_CTRL_SW_RST) reset();
+            return true;
+        }
+
+        m_regs[addr] = data;
+        m_known |= 1UL << addr;
+
+        return true;
+    }
+
+    // Returns false when a stable register disagrees with the model.
+    bool read(uint8_t addr, uint8_t captured)
+    {
+        const Fxl6408Register_t *desc = find_register(addr);
+        if (desc == NULL || desc->is_volatile) return true;
+
+        if ((m_known & (1UL << addr)) == 0)
+        {
+            m_regs[addr] = captured;
+            m_known |= 1UL << addr;
+            return true;
+        }
+
+        return m_regs[addr] == captured;
+    }
+
+private:
+    uint8_t m_regs[REPLAY_ADDRESS_SPACE];
+    uint32_t m_known;
+};
+
+/*
+ * Standard-mode framing: every byte costs 9 clocks (8 data + ACK), plus one
+ * clock each for START, repeated START and STOP.
+ */
+static uint64_t modeled_bus_us(bool write, uint8_t len, uint32_t clock_hz)
+{
+    uint32_t bits = write ? (2 + len) * 9 + 2 : (3 + len) * 9 + 3;
+
+    return ((uint64_t) bits * 1000000 + clock_hz - 1) / clock_hz;
+}
+
+static bool load_file(const char *path, std::vector<uint8_t> *data)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("failed to open %s\r\n", path);
+        return false;
+    }
+
+    uint8_t chunk[512];
+    size_t read = 0;
+
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data->insert(data->end(), chunk, chunk + read);
+
+    fclose(file);
+
+    return true;
+}
+
+static bool replay(const char *path, const std::vector<uint8_t> &data, uint32_t clock_hz,
+                   ReplayReport_t *report)
+{
+    memset(report, 0, sizeof(*report));
+    report->path = path;
+
+    Fxl6408CaptureHeader_t header;
+
+    if (data.size() < sizeof(header))
+    {
+        printf("%s: truncated header\r\n", path);
+        return false;
+    }
+
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (header.magic != FXL6408_CAPTURE_MAGIC || header.version != FXL6408_CAPTURE_VERSION)
+    {
+        printf("%s: not a version %u FXL6408 capture\r\n", path, FXL6408_CAPTURE_VERSION);
+        return false;
+    }
+
+    report->dropped = header.dropped;
+
+    SimulatedFxl6408 device;
+    size_t offset = sizeof(header);
+
+    while (offset < data.size())
+    {
+        Fxl6408CaptureRecord_t record;
+
+        if (offset + sizeof(record) > data.size())
+        {
+            printf("%s: truncated record at offset %zu\r\n", path, offset);
+            return false;
+        }
+
+        memcpy(&record, data.data() + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if (offset + record.len > data.size())
+        {
+            printf("%s: truncated data at offset %zu\r\n", path, offset);
+            return false;
+        }
+
+        const uint8_t *bytes = data.data() + offset;
+        offset += record.len;
+
+        // a hardware reset through the RST pin, not a bus transaction
+        if (record.flags & FXL6408_CAPTURE_FLAG_RESET)
+        {
+            report->resets++;
+            device.reset();
+            continue;
+        }
+
+        bool write = (record.flags & FXL6408_CAPTURE_FLAG_WRITE) != 0;
+
+        report->transactions++;
+        report->measured_us += record.duration_us;
+        report->modeled_us += modeled_bus_us(write, record.len, clock_hz);
+        report->span_us = record.start_us + record.duration_us;
+
+        if (write) report->writes++;
+        else report->reads++;
+
+        if (record.flags & FXL6408_CAPTURE_FLAG_ERROR)
+        {
+            report->errors++;
+            continue;
+        }
+
+        // the FXL6408 auto-increments the register address in bursts
+        for (uint8_t idx = 0; idx < record.len; idx++)
+        {
+            uint8_t addr = (record.reg + idx) % REPLAY_ADDRESS_SPACE;
+
+            if (write)
+            {
+                report->reg_writes[addr]++;
+                if (!device.write(addr, bytes[idx])) report->illegal++;
+            }
+            else
+            {
+                report->reg_reads[addr]++;
+                if (!device.read(addr, bytes[idx])) report->mismatches++;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void print_report(const ReplayReport_t *report)
+{
+    printf("%s\r\n", report->path);
+    printf("  transactions  %u (%u reads, %u writes, %u errors, %u dropped, %u resets)\r\n",
+           report->transactions, report->reads, report->writes, report->errors, report->dropped,
+           report->resets);
+    printf("  bus time      %llu us measured, %llu us modeled\r\n",
+           (unsigned long long) report->measured_us, (unsigned long long) report->modeled_us);
+    printf("  span          %llu us\r\n", (unsigned long long) report->span_us);
+    printf("  mismatches    %u reads, %u illegal writes\r\n", report->mismatches, report->illegal);
+
+    for (int idx = 0; idx < FXL6408_REG_COUNT; idx++)
+    {
+        uint8_t addr = fxl6408_registers[idx].addr;
+
+        if (report->reg_reads[addr] == 0 && report->reg_writes[addr] == 0) continue;
+
+        printf("  %-10s    %u reads, %u writes\r\n", fxl6408_registers[idx].name,
+               report->reg_reads[addr], report->reg_writes[addr]);
+    }
+}
+
+static void print_delta(const char *label, uint64_t baseline, uint64_t candidate)
+{
+    long long delta = (long long) candidate - (long long) baseline;
+    double percent = baseline != 0 ? 100.0 * delta / baseline : 0.0;
+
+    printf("  %-14s %llu -> %llu (%+lld, %+.1f%%)\r\n", label, (unsigned long long) baseline,
+           (unsigned long long) candidate, delta, percent);
+}
+
+/*
+ * Built-in synthetic captures, one per modelling rule, with the result the
+ * replayer must report for each.
+ */
+typedef struct
+{
+    uint64_t start_us;
+    uint8_t reg;
+    uint8_t flags;
+    uint8_t data;           // ignored for reset markers
+} SelfTestRecord_t;
+
+typedef struct
+{
+    const char *name;
+    const SelfTestRecord_t *records;
+    size_t count;
+    uint32_t mismatches;
+    uint32_t illegal;
+    uint32_t resets;
+} SelfTestCase_t;
+
+#define SELF_TEST_WRITE     FXL6408_CAPTURE_FLAG_WRITE
+#define SELF_TEST_RESET     FXL6408_CAPTURE_FLAG_RESET
+
+static const SelfTestRecord_t self_test_mid_session[] =
+{
+    { 0, FXL6408_ADDRESS_IO_DIR, 0, 0x40 },
+    { 100, FXL6408_ADDRESS_IO_DIR, SELF_TEST_WRITE, 0x60 },
+    { 200, FXL6408_ADDRESS_IO_DIR, 0, 0x60 },
+};
+
+static const SelfTestRecord_t self_test_hw_reset[] =
+{
+    { 0, FXL6408_ADDRESS_OUT_STATE, SELF_TEST_WRITE, 0x80 },
+    { 100, 0, SELF_TEST_RESET, 0 },
+    { 200, FXL6408_ADDRESS_OUT_STATE, 0, 0x00 },
+};
+
+static const SelfTestRecord_t self_test_sw_reset[] =
+{
+    { 0, FXL6408_ADDRESS_OUT_HIGHZ, 0, 0x00 },
+    { 100, FXL6408_ADDRESS_UID_CTRL, SELF_TEST_WRITE, 0xA2 | FXL6408_UID_CTRL_SW_RST },
+    { 200, FXL6408_ADDRESS_OUT_HIGHZ, 0, 0xFF },
+};
+
+static const SelfTestRecord_t self_test_mismatch[] =
+{
+    { 0, FXL6408_ADDRESS_OUT_STATE, SELF_TEST_WRITE, 0x80 },
+    { 100, FXL6408_ADDRESS_OUT_STATE, 0, 0x00 },
+};
+
+static const SelfTestRecord_t self_test_illegal[] =
+{
+    { 0, FXL6408_ADDRESS_IN_STATUS, SELF_TEST_WRITE, 0x01 },
+    { 100, FXL6408_ADDRESS_RESERVED_1, SELF_TEST_WRITE, 0x01 },
+};
+
+// longer than the 71 minutes a 32-bit microsecond timestamp can hold
+static const SelfTestRecord_t self_test_long[] =
+{
+    { 0, FXL6408_ADDRESS_IN_STATUS, 0, 0x00 },
+    { 5000000000ULL, FXL6408_ADDRESS_IN_STATUS, 0, 0x01 },
+};
+
+#define SELF_TEST_CASE(name, records, mismatches, illegal, resets) \
+    { name, records, sizeof(records) / sizeof(records[0]), mismatches, illegal, resets }
+
+static const SelfTestCase_t self_test_cases[] =
+{
+    SELF_TEST_CASE("mid-session", self_test_mid_session, 0, 0, 0),
+    SELF_TEST_CASE("hw-reset", self_test_hw_reset, 0, 0, 1),
+    SELF_TEST_CASE("sw-reset", self_test_sw_reset, 0, 0, 0),
+    SELF_TEST_CASE("mismatch", self_test_mismatch, 1, 0, 0),
+    SELF_TEST_CASE("illegal", self_test_illegal, 0, 2, 0),
+    SELF_TEST_CASE("long", self_test_long, 0, 0, 0),
+};
+
+static void build_capture(const SelfTestCase_t *test, std::vector<uint8_t> *data)
+{
+    Fxl6408CaptureHeader_t header = {};
+    header.magic = FXL6408_CAPTURE_MAGIC;
+    header.version = FXL6408_CAPTURE_VERSION;
+    header.addr = 0x44;
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&header);
+    data->insert(data->end(), bytes, bytes + sizeof(header));
+
+    for (size_t idx = 0; idx < test->count; idx++)
+    {
+        const SelfTestRecord_t *entry = &test->records[idx];
+
+        Fxl6408CaptureRecord_t record = {};
+        record.start_us = entry->start_us;
+        record.duration_us = 60;
+        record.reg = entry->reg;
+        record.flags = entry->flags;
+        record.len = (entry->flags & SELF_TEST_RESET) ? 0 : 1;
+
+        bytes = reinterpret_cast<const uint8_t *>(&record);
+        data->insert(data->end(), bytes, bytes + sizeof(record));
+        if (record.len > 0) data->push_back(entry->data);
+    }
+}
+
+static int self_test(uint32_t clock_hz)
+{
+    int failed = 0;
+
+    for (size_t idx = 0; idx < sizeof(self_test_cases) / sizeof(self_test_cases[0]); idx++)
+    {
+        const SelfTestCase_t *test = &self_test_cases[idx];
+        const SelfTestRecord_t *last = &test->records[test->count - 1];
+        std::vector<uint8_t> data;
+        ReplayReport_t report;
+
+        build_capture(test, &data);
+
+        bool ok = replay(test->name, data, clock_hz, &report) &&
+                  report.mismatches == test->mismatches && report.illegal == test->illegal &&
+                  report.resets == test->resets && report.span_us == last->start_us + 60;
+
+        printf("%-12s %s\r\n", test->name, ok ? "ok" : "FAIL");
+        if (!ok) failed++;
+    }
+
+    return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t clock_hz = REPLAY_DEFAULT_CLOCK_HZ;
+    const char *paths[2] = { NULL, NULL };
+    int count = 0;
+
+    bool test = false;
+
+    for (int idx = 1; idx < argc; idx++)
+    {
+        if (strcmp(argv[idx], "-c") == 0 && idx + 1 < argc)
+            clock_hz = strtoul(argv[++idx], NULL, 0);
+        else if (strcmp(argv[idx], "-t") == 0)
+            test = true;
+        else if (count < 2)
+            paths[count++] = argv[idx];
+    }
+
+    if (test && clock_hz != 0) return self_test(clock_hz);
+
+    if (count == 0 || clock_hz == 0)
+    {
+        printf("usage: %s [-c clock_hz] baseline.bin [candidate.bin]\r\n", argv[0]);
+        printf("       %s -t\r\n", argv[0]);
+        return 1;
+    }
+
+    ReplayReport_t reports[2];
+
+    for (int idx = 0; idx < count; idx++)
+    {
+        std::vector<uint8_t> data;
+
+        if (!load_file(paths[idx], &data)) return 1;
+        if (!replay(paths[idx], data, clock_hz, &reports[idx])) return 1;
+        print_report(&reports[idx]);
+    }
+
+    if (count == 2)
+    {
+        printf("delta\r\n");
+        print_delta("transactions", reports[0].transactions, reports[1].transactions);
+        print_delta("reads", reports[0].reads, reports[1].reads);
+        print_delta("writes", reports[0].writes, reports[1].writes);
+        print_delta("measured us", reports[0].measured_us, reports[1].measured_us);
+        print_delta("modeled us", reports[0].modeled_us, reports[1].modeled_us);
+    }
+
+    return 0;
+}